@@ -0,0 +1,47 @@
+#include "Arena.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+Arena::Arena(const std::size_t capacity)
+    : block(new std::byte[capacity]) // Left uninitialized, pages are only touched when used.
+    , blockSize(capacity)
+{
+    bump.emplace(block.get(), blockSize, &spill);
+}
+
+void Arena::reset(const std::size_t expectedBytes)
+{
+    const std::size_t wanted = std::min(std::max(expectedBytes, blockSize + spill.bytes), MAX_CAPACITY);
+    if (wanted > blockSize)
+    {
+        bump.reset();
+        block.reset(new std::byte[wanted]);
+        blockSize = wanted;
+        bump.emplace(block.get(), blockSize, &spill);
+    }
+    else
+    {
+        // Returns the spilled blocks, if any, and rewinds to the start of the block.
+        bump->release();
+    }
+    spill.bytes = 0;
+}
+
+void* Arena::Spill::do_allocate(const std::size_t size, const std::size_t alignment)
+{
+    bytes += size;
+    return std::pmr::new_delete_resource()->allocate(size, alignment);
+}
+
+void Arena::Spill::do_deallocate(void* p, const std::size_t size, const std::size_t alignment)
+{
+    std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+}
+
+bool Arena::Spill::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
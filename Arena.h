@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+// Bump allocator for everything one compilation produces: the code, line table
+// and constants of the chunk and the scratch vectors of the compiler passes.
+// Nothing is freed individually; reset() drops it all at once and hands the
+// same block to the next script.
+class Arena
+{
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 16 * 1024;
+    static constexpr std::size_t MAX_CAPACITY = 4 * 1024 * 1024; // Bigger scripts spill to the heap.
+
+    explicit Arena(std::size_t capacity = DEFAULT_CAPACITY);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Invalidates every allocation made since the last reset. The block grows to
+    // expectedBytes, or to what the last compilation had to take from the heap,
+    // so that a steady stream of similar scripts stops allocating altogether.
+    void reset(std::size_t expectedBytes = 0);
+
+    std::pmr::memory_resource* resource() { return &*bump; }
+    std::size_t capacity() const { return blockSize; }
+
+private:
+    // Upstream of the bump resource, counts what did not fit in the block.
+    class Spill : public std::pmr::memory_resource
+    {
+    public:
+        std::size_t bytes = 0;
+
+    private:
+        void* do_allocate(std::size_t size, std::size_t alignment) override;
+        void do_deallocate(void* p, std::size_t size, std::size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+    };
+
+    std::unique_ptr<std::byte[]> block;
+    std::size_t blockSize = 0;
+    Spill spill;
+    std::optional<std::pmr::monotonic_buffer_resource> bump;
+};
@@ -0,0 +1,166 @@
+#include "Batch.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+#include "BytecodeCache.h"
+#include "Chunk.h"
+#include "Compiler.h"
+#include "Source.h"
+#include "Value.h"
+#include "VM.h"
+#include "WorkStealingPool.h"
+
+// What a script leaves behind, kept until every script before it is printed.
+struct ScriptResult
+{
+    int status = 0;
+    std::string value;
+    std::string errors;
+};
+
+// Everything a worker reuses from one script to the next.
+struct BatchWorker
+{
+    VM vm;
+    Arena arena;
+};
+
+bool readManifest(const char* path, std::vector<std::string>* paths)
+{
+    std::ifstream manifest(path);
+    if (!manifest)
+    {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        paths->push_back(line);
+    }
+    return true;
+}
+
+static int exitStatus(const InterpretResult result)
+{
+    switch (result)
+    {
+    case INTERPRET_COMPILE_ERROR:   return 65;
+    case INTERPRET_RUNTIME_ERROR:   return 70;
+    default:                        return 0;
+    }
+}
+
+static InterpretResult compileAndRun(BatchWorker& worker, const std::string& path, const Source& source,
+                                     const bool useCache, std::string* errors)
+{
+    const std::string cachePath = path + "c";
+    const std::uint64_t hash = useCache ? hashSource(source) : 0;
+    if (useCache)
+    {
+        MappedChunk mapped;
+        if (mapped.open(cachePath.c_str(), hash))
+        {
+            return worker.vm.interpret(mapped.view());
+        }
+    }
+
+    worker.arena.reset(Compiler::arenaBytes(source.size()));
+    Chunk chunk(worker.arena.resource());
+    Compiler compiler;
+    compiler.setErrorOutput(errors);
+    if (!compiler.compile(source, &chunk))
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    if (useCache)
+    {
+        writeBytecode(cachePath.c_str(), chunk, hash);
+    }
+    return worker.vm.interpret(chunk);
+}
+
+static void runScript(BatchWorker& worker, const std::string& path, const bool useCache, ScriptResult* result)
+{
+    Source source;
+    if (!source.openFile(path.c_str()))
+    {
+        result->errors = source.error() + "\n";
+        result->status = 74;
+        return;
+    }
+
+    worker.vm.resetGlobals(); // Scripts are independent, whichever worker runs them.
+    worker.vm.setErrorOutput(&result->errors);
+    const InterpretResult interpreted = compileAndRun(worker, path, source, useCache, &result->errors);
+    worker.vm.setErrorOutput(nullptr);
+
+    result->status = exitStatus(interpreted);
+    if (interpreted == INTERPRET_OK)
+    {
+        result->value = formatValue(worker.vm.lastResult());
+    }
+}
+
+static void printErrors(const std::string& path, const std::string& errors)
+{
+    std::size_t start = 0;
+    while (start < errors.size())
+    {
+        std::size_t end = errors.find('\n', start);
+        if (end == std::string::npos)
+        {
+            end = errors.size();
+        }
+        fprintf(stderr, "%s: %.*s\n", path.c_str(), static_cast<int>(end - start), errors.data() + start);
+        start = end + 1;
+    }
+}
+
+int runBatch(const std::vector<std::string>& paths, const BatchOptions& options)
+{
+    std::vector<ScriptResult> results(paths.size());
+
+    // A worker without a script would only cost a thread and a VM.
+    WorkStealingPool pool(static_cast<unsigned>(std::min<std::size_t>(options.jobs, paths.size())));
+    std::vector<BatchWorker> workers(pool.workerCount());
+    for (BatchWorker& worker : workers)
+    {
+        worker.vm.setJit(options.jit);
+    }
+    pool.run(paths.size(), [&](const unsigned worker, const std::size_t index)
+    {
+        runScript(workers[worker], paths[index], options.useCache, &results[index]);
+    });
+
+    int status = 0;
+    for (std::size_t i = 0; i < paths.size(); i++)
+    {
+        const ScriptResult& result = results[i];
+        printErrors(paths[i], result.errors);
+        if (result.status == 0)
+        {
+            printf("%s: %s\n", paths[i].c_str(), result.value.c_str());
+        }
+        else if (status == 0)
+        {
+            status = result.status;
+        }
+    }
+    return status;
+}
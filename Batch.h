@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+constexpr unsigned MAX_JOBS = 1024;
+
+struct BatchOptions
+{
+    unsigned jobs = 1;      // Worker threads, each with its own VM and compile arena; no more than the scripts.
+    bool useCache = false;  // Same .loxc cache as single script runs.
+    bool jit = false;       // VM::setJit() on every worker.
+};
+
+// Reads the script paths listed in a manifest file, one per line. Blank lines
+// and lines starting with '#' are skipped.
+bool readManifest(const char* path, std::vector<std::string>* paths);
+
+// Compiles and runs every script, in parallel, then prints the results in the
+// order of paths whatever order they finished in: "<path>: <value>" on stdout
+// for each script that ran, and its diagnostics, prefixed with "<path>: ", on
+// stderr. Returns the exit status of the first script that failed, 0 if none.
+int runBatch(const std::vector<std::string>& paths, const BatchOptions& options);
@@ -0,0 +1,409 @@
+#include "BytecodeCache.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CLOXX_HAS_MMAP
+#endif
+
+#include "Chunk.h"
+#include "Compiler.h"
+#include "Object.h"
+#include "Source.h"
+#include "Value.h"
+#include "VM.h"
+
+static constexpr char BYTECODE_MAGIC[4] = {'L', 'O', 'X', 'C'};
+
+static std::size_t alignSection(const std::size_t offset)
+{
+    return (offset + 7) & ~static_cast<std::size_t>(7);
+}
+
+struct SectionLayout
+{
+    std::size_t code;
+    std::size_t lines;
+    std::size_t constants;
+    std::size_t globals;
+    std::size_t end;
+};
+
+static SectionLayout layoutSections(const std::size_t codeSize, const std::size_t lineCount,
+                                    const std::size_t constantCount, const std::size_t globalBytes)
+{
+    SectionLayout layout{};
+    layout.code = sizeof(BytecodeHeader);
+    layout.lines = alignSection(layout.code + codeSize);
+    layout.constants = alignSection(layout.lines + lineCount * sizeof(LineStart));
+    layout.globals = layout.constants + constantCount * sizeof(Value);
+    layout.end = layout.globals + globalBytes;
+    return layout;
+}
+
+static std::uint32_t configurationFlags()
+{
+#ifdef CLOXX_NAN_BOXING
+    return BYTECODE_NAN_BOXING;
+#else
+    return 0;
+#endif
+}
+
+// 64-bit FNV-1a.
+std::uint64_t hashSource(const char* bytes, const std::size_t length)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<std::uint8_t>(bytes[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::uint64_t hashSource(const Source& source)
+{
+    return hashSource(source[0], source.size());
+}
+
+// Whether the constant means the same in any process: long strings are
+// addresses. Short ones must be packed as packShortString() would, or equal
+// strings would compare unequal.
+static bool isPortableConstant(const Value& value)
+{
+    if (IS_OBJ_STRING(value))
+    {
+        return false;
+    }
+    if (IS_SHORT_STRING(value))
+    {
+        const std::uint64_t bits = AS_SHORT_STRING(value);
+        const std::size_t length = shortStringLength(bits);
+        const std::uint64_t chars = bits & ~(std::uint64_t{0xff} << SHORT_STRING_LENGTH_SHIFT);
+        return length <= SHORT_STRING_MAX && chars >> (8 * length) == 0;
+    }
+    return true;
+}
+
+static void writePadding(std::ofstream& file, const std::size_t from, const std::size_t to)
+{
+    static constexpr char zeros[8] = {};
+    file.write(zeros, static_cast<std::streamsize>(to - from));
+}
+
+// Written to a temporary file first and renamed into place, so concurrent
+// runs never map a half-written cache.
+bool writeBytecode(const char* path, const Chunk& chunk, const std::uint64_t sourceHash)
+{
+    for (const Value& constant : chunk.constants.values)
+    {
+        if (!isPortableConstant(constant))
+        {
+            return false;
+        }
+    }
+
+    BytecodeHeader header{};
+    std::memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    header.version = BYTECODE_VERSION;
+    header.valueSize = sizeof(Value);
+    header.opcodeCount = OP_COUNT;
+    header.sourceHash = sourceHash;
+    header.codeSize = static_cast<std::uint32_t>(chunk.code.size());
+    header.lineCount = static_cast<std::uint32_t>(chunk.lines.size());
+    header.constantCount = static_cast<std::uint32_t>(chunk.constants.values.size());
+    header.flags = configurationFlags();
+
+    std::string names;
+    for (const Value& name : chunk.globals)
+    {
+        char scratch[SHORT_STRING_MAX];
+        const std::string_view chars = stringChars(name, scratch);
+        const auto length = static_cast<std::uint32_t>(chars.size());
+        names.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        names.append(chars);
+    }
+    header.globalCount = static_cast<std::uint32_t>(chunk.globals.size());
+    header.globalBytes = static_cast<std::uint32_t>(names.size());
+
+    const SectionLayout layout = layoutSections(header.codeSize, header.lineCount, header.constantCount,
+                                                header.globalBytes);
+    const std::string temporary = std::string(path) + ".tmp";
+
+    {
+        std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(chunk.code.data()), header.codeSize);
+        writePadding(file, layout.code + header.codeSize, layout.lines);
+        file.write(reinterpret_cast<const char*>(chunk.lines.data()), header.lineCount * sizeof(LineStart));
+        writePadding(file, layout.lines + header.lineCount * sizeof(LineStart), layout.constants);
+        file.write(reinterpret_cast<const char*>(chunk.constants.values.data()), header.constantCount * sizeof(Value));
+        file.write(names.data(), static_cast<std::streamsize>(names.size()));
+
+        if (!file)
+        {
+            file.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(temporary.c_str(), path) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+MappedChunk::~MappedChunk()
+{
+    close();
+}
+
+bool MappedChunk::open(const char* path, const std::uint64_t sourceHash)
+{
+    close();
+
+#ifdef CLOXX_HAS_MMAP
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(BytecodeHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    mappingSize = static_cast<std::size_t>(info.st_size);
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        mapping = nullptr;
+        mappingSize = 0;
+        return false;
+    }
+
+    const auto* bytes = static_cast<const std::uint8_t*>(mapping);
+    const auto* header = reinterpret_cast<const BytecodeHeader*>(bytes);
+    if (std::memcmp(header->magic, BYTECODE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != BYTECODE_VERSION ||
+        header->valueSize != sizeof(Value) ||
+        header->opcodeCount != OP_COUNT ||
+        header->flags != configurationFlags() ||
+        header->sourceHash != sourceHash)
+    {
+        close();
+        return false;
+    }
+
+    const SectionLayout layout = layoutSections(header->codeSize, header->lineCount, header->constantCount,
+                                                header->globalBytes);
+    if (layout.end > mappingSize ||
+        !readGlobals(bytes + layout.globals, header->globalBytes, header->globalCount))
+    {
+        close();
+        return false;
+    }
+
+    chunk.code = {bytes + layout.code, header->codeSize};
+    chunk.lines = {reinterpret_cast<const LineStart*>(bytes + layout.lines), header->lineCount};
+    chunk.constants = {reinterpret_cast<const Value*>(bytes + layout.constants), header->constantCount};
+    chunk.globals = globals;
+
+    if (!validate())
+    {
+        close();
+        return false;
+    }
+
+    return true;
+#else
+    (void)path;
+    (void)sourceHash;
+    return false;
+#endif
+}
+
+void MappedChunk::close()
+{
+#ifdef CLOXX_HAS_MMAP
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappingSize);
+    }
+#endif
+
+    mapping = nullptr;
+    mappingSize = 0;
+    chunk = ChunkView{};
+    globals.clear();
+}
+
+bool MappedChunk::readGlobals(const std::uint8_t* names, const std::size_t size, const std::uint32_t count)
+{
+    if (count > MAX_GLOBALS)
+    {
+        return false;
+    }
+
+    std::size_t offset = 0;
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+        std::uint32_t length;
+        if (size - offset < sizeof(length))
+        {
+            return false;
+        }
+        std::memcpy(&length, names + offset, sizeof(length));
+        offset += sizeof(length);
+        if (size - offset < length)
+        {
+            return false;
+        }
+        globals.push_back(makeString(reinterpret_cast<const char*>(names + offset), length));
+        offset += length;
+    }
+    return offset == size;
+}
+
+// The VM trusts its bytecode, so check every operand before running a file,
+// and run the code abstractly the way the compiler typed it: the stack must
+// never underflow nor outgrow STACK_MAX, must hold exactly the result at
+// OP_RETURN, and unchecked instructions must only see operands that are
+// numbers whatever the file's constants and the run's inputs and globals are.
+// Code is straight-line, so every instruction runs once at a known height.
+bool MappedChunk::validate() const
+{
+    std::array<StaticType, STACK_MAX> types;
+    std::size_t height = 0;
+
+    std::size_t offset = 0;
+    std::uint8_t instruction = OP_COUNT;
+    while (offset < chunk.code.size())
+    {
+        instruction = chunk.code[offset];
+        if (instruction >= OP_COUNT || genericOpcode(instruction) != instruction) // Only the VM writes quickened forms.
+        {
+            return false;
+        }
+
+        const std::size_t length = instructionLength(instruction);
+        if (offset + length > chunk.code.size())
+        {
+            return false;
+        }
+        if (instruction == OP_RETURN && offset + length != chunk.code.size())
+        {
+            return false; // The compiler ends every chunk with its only OP_RETURN.
+        }
+        if (instruction == OP_CONSTANT && chunk.code[offset + 1] >= chunk.constants.size())
+        {
+            return false;
+        }
+        if (instruction == OP_CONSTANT_LONG && readLongOperand(&chunk.code[offset + 1]) >= chunk.constants.size())
+        {
+            return false;
+        }
+        if ((instruction == OP_DEFINE_GLOBAL_SLOT || instruction == OP_GET_GLOBAL_SLOT ||
+             instruction == OP_SET_GLOBAL_SLOT) && chunk.code[offset + 1] >= chunk.globals.size())
+        {
+            return false;
+        }
+
+        const std::uint8_t operation = checkedOpcode(instruction);
+        const std::size_t pops = operation == OP_RETURN || operation == OP_NOT || operation == OP_NEGATE ||
+                                 operation == OP_POP || operation == OP_DEFINE_GLOBAL_SLOT ||
+                                 operation == OP_SET_GLOBAL_SLOT ? 1
+                               : operation >= OP_EQUAL && operation <= OP_DIVIDE ? 2 : 0;
+        const std::size_t pushes = operation == OP_POP || operation == OP_DEFINE_GLOBAL_SLOT ||
+                                   operation == OP_RETURN ? 0 : 1;
+        if (height < pops || height - pops + pushes > STACK_MAX)
+        {
+            return false;
+        }
+
+        const StaticType* operands = types.data() + height - pops;
+        if (operation != instruction)
+        {
+            for (std::size_t i = 0; i < pops; i++)
+            {
+                if (operands[i] != TYPE_NUMBER) return false;
+            }
+        }
+
+        // Results as the compiler types them: a failed check stops the run.
+        StaticType result = TYPE_UNKNOWN;
+        switch (operation)
+        {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        {
+            const Value& constant = chunk.constants[operation == OP_CONSTANT ? chunk.code[offset + 1]
+                                                                             : readLongOperand(&chunk.code[offset + 1])];
+            result = IS_NUMBER(constant) ? TYPE_NUMBER : IS_STRING(constant) ? TYPE_STRING : TYPE_UNKNOWN;
+            break;
+        }
+        case OP_NIL:                result = TYPE_NIL; break;
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:         result = TYPE_BOOL; break;
+        case OP_ADD:
+            result = operands[0] == TYPE_NUMBER || operands[1] == TYPE_NUMBER ? TYPE_NUMBER : TYPE_UNKNOWN;
+            break;
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NEGATE:             result = TYPE_NUMBER; break;
+        case OP_SET_GLOBAL_SLOT:    result = operands[0]; break; // Assignment leaves the value it stored.
+        case OP_RETURN:
+            if (height != 1) return false;
+            break;
+        default: ;                  // Inputs and globals hold anything.
+        }
+
+        height = height - pops + pushes;
+        if (pushes != 0)
+        {
+            types[height - 1] = result;
+        }
+        offset += length;
+    }
+
+    for (const Value& constant : chunk.constants)
+    {
+        if (!isPortableConstant(constant))
+        {
+            return false;
+        }
+    }
+
+    return instruction == OP_RETURN;
+}
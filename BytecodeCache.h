@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Chunk.h"
+#include "Source.h"
+
+// A .loxc file holds one compiled chunk: a BytecodeHeader followed by the code
+// bytes, the line table and the constant pool, each section starting on an
+// 8-byte boundary so it can be used in place once the file is mapped. A last
+// section holds the names of the global slots as text, each after its 32-bit
+// length; they are interned when the file is opened.
+// Files use the native byte order and Value layout; a file written by another
+// configuration, or for different source text, is rejected and the caller
+// recompiles. Long string constants point into the process that compiled them,
+// so chunks holding one are never written.
+
+constexpr std::uint16_t BYTECODE_VERSION = 4; // Bump whenever the instruction set or the Value layout changes.
+
+struct BytecodeHeader
+{
+    char magic[4];                  // "LOXC"
+    std::uint16_t version;
+    std::uint8_t valueSize;         // sizeof(Value)
+    std::uint8_t opcodeCount;       // OP_COUNT
+    std::uint64_t sourceHash;
+    std::uint32_t codeSize;
+    std::uint32_t lineCount;
+    std::uint32_t constantCount;
+    std::uint32_t flags;            // BYTECODE_NAN_BOXING
+    std::uint32_t globalCount;
+    std::uint32_t globalBytes;      // Size of the names section.
+};
+
+constexpr std::uint32_t BYTECODE_NAN_BOXING = 1 << 0;
+
+std::uint64_t hashSource(const char* bytes, std::size_t length); // 64-bit FNV-1a.
+std::uint64_t hashSource(const Source& source);
+bool writeBytecode(const char* path, const Chunk& chunk, std::uint64_t sourceHash);
+
+// A chunk executed straight from a read-only mapping of its .loxc file.
+class MappedChunk
+{
+public:
+    MappedChunk() = default;
+    ~MappedChunk();
+
+    MappedChunk(const MappedChunk&) = delete;
+    MappedChunk& operator=(const MappedChunk&) = delete;
+
+    bool open(const char* path, std::uint64_t sourceHash);
+    const ChunkView& view() const { return chunk; }
+
+private:
+    void* mapping = nullptr;
+    std::size_t mappingSize = 0;
+    ChunkView chunk{};
+    std::vector<Value> globals; // Interned from the names section.
+
+    void close();
+    bool readGlobals(const std::uint8_t* names, std::size_t size, std::uint32_t count);
+    bool validate() const;
+};
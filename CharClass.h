@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Character classes of every byte, shared by the Scanner and its kernels.
+enum CharClass: std::uint8_t
+{
+    CHAR_DIGIT      = 1 << 0,   // 0-9
+    CHAR_ALPHA      = 1 << 1,   // a-z A-Z _
+    CHAR_WHITESPACE = 1 << 2,   // ' ' \t \r \n
+};
+
+constexpr std::array<std::uint8_t, 256> CHAR_CLASSES = []
+{
+    std::array<std::uint8_t, 256> classes{};
+    for (int c = '0'; c <= '9'; c++) classes[c] |= CHAR_DIGIT;
+    for (int c = 'a'; c <= 'z'; c++) classes[c] |= CHAR_ALPHA;
+    for (int c = 'A'; c <= 'Z'; c++) classes[c] |= CHAR_ALPHA;
+    classes['_'] |= CHAR_ALPHA;
+    for (const int c : {' ', '\t', '\r', '\n'}) classes[c] |= CHAR_WHITESPACE;
+    return classes;
+}();
+
+constexpr bool hasCharClass(const char c, const std::uint8_t classes)
+{
+    return (CHAR_CLASSES[static_cast<unsigned char>(c)] & classes) != 0;
+}
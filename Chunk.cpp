@@ -1,11 +1,100 @@
 #include "Chunk.h"
 #include "Value.h"
 
+#include <algorithm>
 #include <cstdint>
 
+std::size_t instructionLength(const std::uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_CONSTANT:               return 2;
+    case OP_CONSTANT_LONG:          return 4;
+    case OP_INPUT:                  return 2;
+    case OP_DEFINE_GLOBAL_SLOT:     return 2;
+    case OP_GET_GLOBAL_SLOT:        return 2;
+    case OP_SET_GLOBAL_SLOT:        return 2;
+    default:                        return 1;
+    }
+}
+
+std::uint8_t quickenedOpcode(const std::uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_GREATER:        return OP_GREATER_NUM;
+    case OP_GREATER_EQUAL:  return OP_GREATER_EQUAL_NUM;
+    case OP_LESS:           return OP_LESS_NUM;
+    case OP_LESS_EQUAL:     return OP_LESS_EQUAL_NUM;
+    case OP_ADD:            return OP_ADD_NUM;
+    case OP_SUBTRACT:       return OP_SUBTRACT_NUM;
+    case OP_MULTIPLY:       return OP_MULTIPLY_NUM;
+    case OP_DIVIDE:         return OP_DIVIDE_NUM;
+    case OP_NEGATE:         return OP_NEGATE_NUM;
+    default:                return instruction;
+    }
+}
+
+std::uint8_t genericOpcode(const std::uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_GREATER_NUM:        return OP_GREATER;
+    case OP_GREATER_EQUAL_NUM:  return OP_GREATER_EQUAL;
+    case OP_LESS_NUM:           return OP_LESS;
+    case OP_LESS_EQUAL_NUM:     return OP_LESS_EQUAL;
+    case OP_ADD_NUM:            return OP_ADD;
+    case OP_SUBTRACT_NUM:       return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM:       return OP_MULTIPLY;
+    case OP_DIVIDE_NUM:         return OP_DIVIDE;
+    case OP_NEGATE_NUM:         return OP_NEGATE;
+    default:                    return instruction;
+    }
+}
+
+std::uint8_t uncheckedOpcode(const std::uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_GREATER:        return OP_GREATER_UNCHECKED;
+    case OP_GREATER_EQUAL:  return OP_GREATER_EQUAL_UNCHECKED;
+    case OP_LESS:           return OP_LESS_UNCHECKED;
+    case OP_LESS_EQUAL:     return OP_LESS_EQUAL_UNCHECKED;
+    case OP_ADD:            return OP_ADD_UNCHECKED;
+    case OP_SUBTRACT:       return OP_SUBTRACT_UNCHECKED;
+    case OP_MULTIPLY:       return OP_MULTIPLY_UNCHECKED;
+    case OP_DIVIDE:         return OP_DIVIDE_UNCHECKED;
+    case OP_NEGATE:         return OP_NEGATE_UNCHECKED;
+    default:                return instruction;
+    }
+}
+
+std::uint8_t checkedOpcode(const std::uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_GREATER_UNCHECKED:          return OP_GREATER;
+    case OP_GREATER_EQUAL_UNCHECKED:    return OP_GREATER_EQUAL;
+    case OP_LESS_UNCHECKED:             return OP_LESS;
+    case OP_LESS_EQUAL_UNCHECKED:       return OP_LESS_EQUAL;
+    case OP_ADD_UNCHECKED:              return OP_ADD;
+    case OP_SUBTRACT_UNCHECKED:         return OP_SUBTRACT;
+    case OP_MULTIPLY_UNCHECKED:         return OP_MULTIPLY;
+    case OP_DIVIDE_UNCHECKED:           return OP_DIVIDE;
+    case OP_NEGATE_UNCHECKED:           return OP_NEGATE;
+    default:                            return instruction;
+    }
+}
+
 void Chunk::writeChunk(const std::uint8_t byte, const int line) {
     code.push_back(byte);
-    lines.push_back(line);
+
+    if (!lines.empty() && lines.back().line == line)
+    {
+        return;
+    }
+
+    lines.push_back(LineStart{static_cast<int>(code.size() - 1), line});
 }
 
 int Chunk::addConstant(Value value)
@@ -13,3 +102,27 @@ int Chunk::addConstant(Value value)
     constants.writeValue(value);
     return constants.values.size() - 1;
 }
+
+void Chunk::truncate(const std::size_t size)
+{
+    code.resize(size);
+
+    while (!lines.empty() && lines.back().offset >= static_cast<int>(size))
+    {
+        lines.pop_back();
+    }
+}
+
+int Chunk::getLine(const std::size_t offset) const
+{
+    return view().getLine(offset);
+}
+
+// Only used to report errors and disassemble, so a binary search is enough.
+int ChunkView::getLine(const std::size_t offset) const
+{
+    const auto next = std::upper_bound(lines.begin(), lines.end(), static_cast<int>(offset),
+        [](const int o, const LineStart& start) { return o < start.offset; });
+
+    return next == lines.begin() ? 0 : (next - 1)->line;
+}
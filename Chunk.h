@@ -1,19 +1,31 @@
 #pragma once
 
 #include <vector>
+#include <cstddef>
 #include <cstdint>
+#include <span>
+#include <memory_resource>
 
 #include "Value.h"
 
 enum OpCode: std::uint8_t
 {
     OP_CONSTANT,
+    OP_CONSTANT_LONG,   // 24-bit pool index, for chunks with more than 256 constants.
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
+    OP_INPUT,           // Input bound to the VM, by its index in CompilerOptions::inputs.
+    OP_POP,
+    OP_DEFINE_GLOBAL_SLOT,  // Global variables, by their slot in the chunk: see ChunkView::globals.
+    OP_GET_GLOBAL_SLOT,
+    OP_SET_GLOBAL_SLOT,
     OP_EQUAL,
+    OP_NOT_EQUAL,
     OP_GREATER,
+    OP_GREATER_EQUAL,
     OP_LESS,
+    OP_LESS_EQUAL,
     OP_ADD,
     OP_SUBTRACT,
     OP_MULTIPLY,
@@ -21,17 +33,93 @@ enum OpCode: std::uint8_t
     OP_NOT,
     OP_NEGATE,
     OP_RETURN,
+
+    // Forms without operand checks, emitted by the compiler where it proved
+    // the operands are numbers.
+    OP_GREATER_UNCHECKED,
+    OP_GREATER_EQUAL_UNCHECKED,
+    OP_LESS_UNCHECKED,
+    OP_LESS_EQUAL_UNCHECKED,
+    OP_ADD_UNCHECKED,
+    OP_SUBTRACT_UNCHECKED,
+    OP_MULTIPLY_UNCHECKED,
+    OP_DIVIDE_UNCHECKED,
+    OP_NEGATE_UNCHECKED,
+
+    // Quickened forms, never emitted by the compiler: the VM rewrites a generic
+    // instruction into one of these in its own copy of the code once it has seen
+    // number operands, and back if it sees anything else.
+    OP_GREATER_NUM,
+    OP_GREATER_EQUAL_NUM,
+    OP_LESS_NUM,
+    OP_LESS_EQUAL_NUM,
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_NEGATE_NUM,
+
+    OP_COUNT, // Number of opcodes, not an instruction.
+};
+
+// Size in bytes of an instruction, opcode included.
+std::size_t instructionLength(std::uint8_t instruction);
+
+// The quickened form of a generic instruction and the generic form of a
+// quickened one. Other instructions map to themselves.
+std::uint8_t quickenedOpcode(std::uint8_t instruction);
+std::uint8_t genericOpcode(std::uint8_t instruction);
+
+// The unchecked form of a checked instruction and the checked form of an
+// unchecked one. Other instructions map to themselves.
+std::uint8_t uncheckedOpcode(std::uint8_t instruction);
+std::uint8_t checkedOpcode(std::uint8_t instruction);
+
+constexpr std::uint32_t MAX_CONSTANTS = 1 << 24; // Addressable by OP_CONSTANT_LONG.
+constexpr std::size_t MAX_GLOBALS = 256; // Global slots of one chunk, addressable by a byte.
+
+// The three operand bytes of OP_CONSTANT_LONG, least significant first.
+inline std::uint32_t readLongOperand(const std::uint8_t* operand)
+{
+    return operand[0] | operand[1] << 8 | operand[2] << 16;
+}
+
+// First code offset of a run of bytes compiled from the same source line.
+struct LineStart
+{
+    int offset;
+    int line;
+};
+
+// Read-only view of the code, line table and constants of a chunk, whether it
+// is owned by a Chunk or mapped from a bytecode cache file.
+struct ChunkView
+{
+    std::span<const std::uint8_t> code;
+    std::span<const LineStart> lines;
+    std::span<const Value> constants;
+    std::span<const Value> globals; // Name of each global slot, as a string. The VM maps them to its own slots.
+
+    int getLine(std::size_t offset) const;
 };
 
+// Storage comes from the heap by default, or from the Arena of a compilation.
 class Chunk
 {
 public:
-    std::vector<std::uint8_t> code;
-    std::vector<int> lines;
+    std::pmr::vector<std::uint8_t> code;
+    std::pmr::vector<LineStart> lines; // Run-length encoded, sorted by offset.
     ValueArray constants;
+    std::pmr::vector<Value> globals;
 
     Chunk() = default;
+    explicit Chunk(std::pmr::memory_resource* resource)
+        : code(resource), lines(resource), constants(resource), globals(resource) {}
 
     void writeChunk(std::uint8_t byte, int line);
     int addConstant(Value value);
+    void truncate(std::size_t size);
+    int getLine(std::size_t offset) const;
+    ChunkView view() const { return ChunkView{code, lines, constants.values, globals}; }
+    std::pmr::memory_resource* resource() const { return code.get_allocator().resource(); }
 };
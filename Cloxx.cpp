@@ -1,15 +1,238 @@
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "VM.h"
 #include "Source.h"
+#include "Chunk.h"
+#include "Compiler.h"
+#include "BytecodeCache.h"
+#include "Batch.h"
+#include "Debug.h"
+#include "Profiler.h"
+#include "PerfCounters.h"
+#include "Server.h"
 
-void runFile(const char* path)
+struct RunOptions
+{
+    bool useCache = false;
+    bool trace = false;
+    bool dumpBytecode = false;
+    bool profile = false;
+    const char* profileJsonPath = nullptr;
+    bool perfStats = false;
+    bool gcStats = false;
+    bool jit = false;
+};
+
+// Hardware events counted while compiling and while running, for --perf-stats.
+struct PhaseCounts
+{
+    const PerfCounters* counters = nullptr; // Null when not requested or not available.
+    PerfCounts compile;
+    PerfCounts run;
+};
+
+// Runs the chunk cached in "<path>c" when it was compiled from the same source,
+// otherwise compiles the source and refreshes the cache.
+InterpretResult runCached(VM& vm, const char* path, const Source& source, const CompilerOptions& compilerOptions,
+                          PhaseCounts& phases)
+{
+    const std::string cachePath = std::string(path) + "c";
+    const std::uint64_t hash = hashSource(source);
+
+    MappedChunk mapped;
+    if (mapped.open(cachePath.c_str(), hash))
+    {
+        if (compilerOptions.dumpBytecode)
+        {
+            disassembleChunk(mapped.view(), "code");
+        }
+        PerfScope scope(phases.counters, &phases.run);
+        return vm.interpret(mapped.view());
+    }
+
+    Compiler compiler(compilerOptions);
+    Chunk chunk;
+    bool compiled;
+    {
+        PerfScope scope(phases.counters, &phases.compile);
+        compiled = compiler.compile(source, &chunk);
+    }
+    if (!compiled)
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    writeBytecode(cachePath.c_str(), chunk, hash); // A missing cache only costs a recompile.
+    PerfScope scope(phases.counters, &phases.run);
+    return vm.interpret(chunk);
+}
+
+InterpretResult runSource(VM& vm, const Source& source, const CompilerOptions& compilerOptions, PhaseCounts& phases)
+{
+    Compiler compiler(compilerOptions);
+    Chunk chunk;
+    bool compiled;
+    {
+        PerfScope scope(phases.counters, &phases.compile);
+        compiled = compiler.compile(source, &chunk);
+    }
+    if (!compiled)
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    PerfScope scope(phases.counters, &phases.run);
+    return vm.interpret(chunk);
+}
+
+void writePerfStats(const PhaseCounts& phases)
+{
+    fprintf(stderr, "== perf counters ==\n%-8s", "phase");
+    for (int event = 0; event < PERF_EVENT_COUNT; event++)
+    {
+        fprintf(stderr, " %14s", perfEventName(static_cast<PerfEvent>(event)));
+    }
+    fprintf(stderr, " %6s\n", "IPC");
+
+    const std::pair<const char*, const PerfCounts*> rows[] = {{"compile", &phases.compile}, {"run", &phases.run}};
+    for (const auto& [name, counts] : rows)
+    {
+        fprintf(stderr, "%-8s", name);
+        for (int event = 0; event < PERF_EVENT_COUNT; event++)
+        {
+            if (phases.counters->has(static_cast<PerfEvent>(event)))
+            {
+                fprintf(stderr, " %14llu", static_cast<unsigned long long>(counts->values[event]));
+            }
+            else
+            {
+                fprintf(stderr, " %14s", "-");
+            }
+        }
+
+        const std::uint64_t cycles = counts->values[PERF_CYCLES];
+        if (cycles > 0 && phases.counters->has(PERF_INSTRUCTIONS))
+        {
+            fprintf(stderr, " %6.2f\n", static_cast<double>(counts->values[PERF_INSTRUCTIONS]) / cycles);
+        }
+        else
+        {
+            fprintf(stderr, " %6s\n", "-");
+        }
+    }
+}
+
+// Collector telemetry of the whole run, for --gc-stats.
+void writeGcStats(const GcStats& stats)
+{
+    const auto pauseUs = [&](const double p) { return static_cast<double>(stats.pauses.percentileNs(p)) / 1000; };
+
+    fprintf(stderr, "== garbage collector ==\n");
+    fprintf(stderr, "%-16s %14zu\n", "cycles", stats.cycles);
+    fprintf(stderr, "%-16s %14zu\n", "bytes allocated", stats.bytesAllocated);
+    fprintf(stderr, "%-16s %14zu\n", "bytes freed", stats.bytesFreed);
+    fprintf(stderr, "%-16s %14zu\n", "heap bytes", stats.heapBytes);
+    fprintf(stderr, "%-16s %14llu\n", "pauses", static_cast<unsigned long long>(stats.pauses.count()));
+    fprintf(stderr, "%-16s %14.3f\n", "p50 pause us", pauseUs(0.5));
+    fprintf(stderr, "%-16s %14.3f\n", "p99 pause us", pauseUs(0.99));
+    fprintf(stderr, "%-16s %14.3f\n", "max pause us", static_cast<double>(stats.pauses.maxNs()) / 1000);
+    if (stats.cycles > 0)
+    {
+        fprintf(stderr, "last cycle: %zu bytes allocated, %zu freed, %zu live, %zu steps\n",
+                stats.last.bytesAllocated, stats.last.bytesFreed, stats.last.liveBytes, stats.last.steps);
+    }
+}
+
+// The table goes to stderr so that it does not mix with the script output.
+void writeProfile(const Profiler& profiler, const char* jsonPath)
+{
+    profiler.printTable(stderr);
+    if (jsonPath == nullptr)
+    {
+        return;
+    }
+
+    std::FILE* file = std::fopen(jsonPath, "w");
+    if (file == nullptr)
+    {
+        std::cerr << "Could not open file \"" << jsonPath << "\"." << std::endl;
+        return;
+    }
+    profiler.writeJson(file);
+    std::fclose(file);
+}
+
+// A path of "-" reads the script from stdin.
+void runFile(const char* path, const RunOptions& options)
 {
     VM vm;
-    const Source source(path);
-    const InterpretResult result = vm.interpret(source);
+    vm.setTrace(options.trace);
+    vm.setJit(options.jit);
+
+    PerfCounters counters;
+    PhaseCounts phases;
+    if (options.perfStats)
+    {
+        if (counters.open())
+        {
+            phases.counters = &counters;
+        }
+        else
+        {
+            std::cerr << "Performance counters are unavailable, running without them: " << counters.error()
+                      << std::endl;
+        }
+    }
+
+    Profiler profiler;
+    if (options.profile)
+    {
+        profiler.setPerfCounters(phases.counters);
+        vm.setProfiler(&profiler);
+    }
 
+    CompilerOptions compilerOptions;
+    compilerOptions.dumpBytecode = options.dumpBytecode;
+
+    Source source;
+    const bool isStdin = std::strcmp(path, "-") == 0;
+    if (!(isStdin ? source.readStream(stdin, "<stdin>") : source.openFile(path)))
+    {
+        std::cerr << source.error() << std::endl;
+        std::exit(74);
+    }
+
+    const InterpretResult result = options.useCache && !isStdin
+        ? runCached(vm, path, source, compilerOptions, phases)
+        : runSource(vm, source, compilerOptions, phases);
+
+    if (options.profile)
+    {
+        writeProfile(profiler, options.profileJsonPath);
+    }
+    if (phases.counters != nullptr)
+    {
+        writePerfStats(phases);
+    }
+    if (options.gcStats)
+    {
+        writeGcStats(vm.getGcStats());
+    }
+
+    if (result == INTERPRET_OK)
+    {
+        printValue(vm.lastResult());
+        printf("\n");
+    }
     if (result == INTERPRET_COMPILE_ERROR)
     {
         std::exit(65);
@@ -20,17 +243,171 @@ void runFile(const char* path)
     }
 }
 
+void usage()
+{
+    std::cerr << "Usage: clox [--cache] [--jit] [--trace] [--dump-bytecode] [--profile] [--profile-json file]"
+              << " [--perf-stats] [--gc-stats] [path]" << std::endl;
+    std::cerr << "       clox [--cache] [--jit] --jobs n [--manifest file] [path...]" << std::endl;
+    std::cerr << "       clox --serve [--jit] [--profile] [--profile-json file] [--socket path]" << std::endl;
+    std::cerr << "       clox --connect path" << std::endl;
+    exit(64);
+}
+
+// The profile, if requested, covers every request and is written once serving ends.
+int runServer(const char* socketPath, const RunOptions& options)
+{
+    EvalServer server;
+    server.setJit(options.jit);
+
+    Profiler profiler;
+    if (options.profile)
+    {
+        server.setProfiler(&profiler);
+    }
+
+    if (socketPath == nullptr)
+    {
+        server.serve(stdin, stdout);
+    }
+    else if (!server.serveSocket(socketPath))
+    {
+        std::cerr << server.error() << std::endl;
+        return 74;
+    }
+
+    if (options.profile)
+    {
+        writeProfile(profiler, options.profileJsonPath);
+    }
+    return 0;
+}
+
+// Sends each request read from stdin to the server and prints its response.
+int runClient(const char* socketPath)
+{
+    EvalClient client;
+    if (!client.connect(socketPath))
+    {
+        std::cerr << client.error() << std::endl;
+        return 74;
+    }
+
+    std::string expression;
+    std::string response;
+    RequestStatus status;
+    while ((status = readRequest(stdin, &expression)) != REQUEST_END)
+    {
+        if (status != REQUEST_OK)
+        {
+            std::cerr << requestErrorMessage(status) << std::endl;
+            return 65;
+        }
+        if (!client.evaluate(expression, &response))
+        {
+            std::cerr << "Lost the connection to \"" << socketPath << "\"." << std::endl;
+            return 74;
+        }
+        std::cout << response << std::endl;
+    }
+    return 0;
+}
+
+// 0 picks one worker per hardware thread. More than MAX_JOBS is rejected.
+unsigned parseJobs(const char* text)
+{
+    char* end;
+    const long jobs = std::strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || jobs < 0 || jobs > MAX_JOBS)
+    {
+        usage();
+    }
+    if (jobs == 0)
+    {
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    return static_cast<unsigned>(jobs);
+}
+
 int main(const int argc, char* argv[])
 {
-    if (argc == 2)
+    RunOptions options;
+    BatchOptions batchOptions;
+    bool batch = false;
+    bool serve = false;
+    const char* socketPath = nullptr;
+    const char* connectPath = nullptr;
+    std::vector<std::string> paths;
+
+    int arg = 1;
+    for (; arg < argc && std::strncmp(argv[arg], "--", 2) == 0; arg++)
     {
-        runFile(argv[1]);
+        if (std::strcmp(argv[arg], "--cache") == 0) options.useCache = true;
+        else if (std::strcmp(argv[arg], "--trace") == 0) options.trace = true;
+        else if (std::strcmp(argv[arg], "--dump-bytecode") == 0) options.dumpBytecode = true;
+        else if (std::strcmp(argv[arg], "--profile") == 0) options.profile = true;
+        else if (std::strcmp(argv[arg], "--perf-stats") == 0) options.perfStats = true;
+        else if (std::strcmp(argv[arg], "--gc-stats") == 0) options.gcStats = true;
+        else if (std::strcmp(argv[arg], "--jit") == 0) options.jit = true;
+        else if (std::strcmp(argv[arg], "--profile-json") == 0 && arg + 1 < argc)
+        {
+            options.profile = true;
+            options.profileJsonPath = argv[++arg];
+        }
+        else if (std::strcmp(argv[arg], "--jobs") == 0 && arg + 1 < argc)
+        {
+            batch = true;
+            batchOptions.jobs = parseJobs(argv[++arg]);
+        }
+        else if (std::strcmp(argv[arg], "--manifest") == 0 && arg + 1 < argc)
+        {
+            batch = true;
+            if (!readManifest(argv[++arg], &paths))
+            {
+                std::cerr << "Could not open file \"" << argv[arg] << "\"." << std::endl;
+                exit(74);
+            }
+        }
+        else if (std::strcmp(argv[arg], "--serve") == 0) serve = true;
+        else if (std::strcmp(argv[arg], "--socket") == 0 && arg + 1 < argc) socketPath = argv[++arg];
+        else if (std::strcmp(argv[arg], "--connect") == 0 && arg + 1 < argc) connectPath = argv[++arg];
+        else usage();
     }
-    else
+    for (; arg < argc; arg++)
+    {
+        paths.push_back(argv[arg]);
+    }
+
+    if (serve || socketPath != nullptr || connectPath != nullptr)
+    {
+        const bool otherOptions = batch || !paths.empty() || options.useCache || options.trace ||
+                                  options.dumpBytecode || options.perfStats || options.gcStats;
+        if (otherOptions || serve == (connectPath != nullptr) || (socketPath != nullptr && !serve) ||
+            ((options.jit || options.profile) && !serve))
+        {
+            usage();
+        }
+        return serve ? runServer(socketPath, options) : runClient(connectPath);
+    }
+
+    if (batch)
+    {
+        // Tracing, disassembly and profiles are printed while scripts run, so
+        // they cannot be kept in order across workers.
+        if (options.trace || options.dumpBytecode || options.profile || options.perfStats || options.gcStats ||
+            paths.empty())
+        {
+            usage();
+        }
+        batchOptions.useCache = options.useCache;
+        batchOptions.jit = options.jit;
+        return runBatch(paths, batchOptions);
+    }
+
+    if (paths.size() != 1)
     {
-        std::cerr << "Usage: clox [path]" << std::endl;
-        exit(64);
+        usage();
     }
+    runFile(paths[0].c_str(), options);
 
     return 0;
 }
@@ -0,0 +1,35 @@
+#pragma once
+
+// Public header of libcloxx, for programs embedding the interpreter.
+//
+//     const CompiledChunk rule = compile("(1 + 2) * 3 > 8");
+//     VM vm;
+//     if (vm.run(rule) == INTERPRET_OK) use(vm.lastResult());
+//
+// Compiling touches the scanner and compiler once; every later run only
+// executes bytecode. A VM allocates nothing between runs and can be reused for
+// any chunk, but runs one chunk at a time: give each thread its own VM.
+//
+// Identifiers listed in CompilerOptions::inputs are bound when the chunk runs:
+// per run with VM::setInputs(), or as whole columns with a ColumnVM, which
+// evaluates a block of rows per instruction and marks failed rows instead of
+// stopping.
+//
+// Strings are immutable. makeString() gives values that can be bound as inputs
+// and compare equal to literals in any chunk; they live until the process
+// exits. Strings a VM builds while running belong to it and are collected
+// incrementally: see VM::lastResult() for how long a result stays valid. A long
+// one is first looked up in the process-wide table, under a shared lock, so
+// that it is the same object as an equal literal. Equal strings built by
+// different VMs, or built before the literal was interned, are distinct
+// objects: == compares their characters.
+
+#include "Chunk.h"
+#include "ColumnVM.h"
+#include "CompiledChunk.h"
+#include "Compiler.h"
+#include "Heap.h"
+#include "Object.h"
+#include "Source.h"
+#include "Value.h"
+#include "VM.h"
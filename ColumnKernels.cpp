@@ -0,0 +1,385 @@
+#include "ColumnKernels.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CLOXX_HAS_X86_SIMD
+#endif
+
+// Scalar kernels, also used for the tail of the vectorized ones.
+
+static double addNumbers(const double a, const double b) { return a + b; }
+static double subtractNumbers(const double a, const double b) { return a - b; }
+static double multiplyNumbers(const double a, const double b) { return a * b; }
+static double divideNumbers(const double a, const double b) { return a / b; }
+static double greaterNumbers(const double a, const double b) { return a > b; }
+static double greaterEqualNumbers(const double a, const double b) { return !(a < b); }
+static double lessNumbers(const double a, const double b) { return a < b; }
+static double lessEqualNumbers(const double a, const double b) { return !(a > b); }
+
+#define SCALAR_NUMBER_KERNEL(name, op) \
+    static void name(const double* a, const double* b, double* out, const std::size_t n) \
+    { \
+        for (std::size_t i = 0; i < n; i++) out[i] = op(a[i], b[i]); \
+    }
+
+SCALAR_NUMBER_KERNEL(scalarAdd, addNumbers)
+SCALAR_NUMBER_KERNEL(scalarSubtract, subtractNumbers)
+SCALAR_NUMBER_KERNEL(scalarMultiply, multiplyNumbers)
+SCALAR_NUMBER_KERNEL(scalarDivide, divideNumbers)
+SCALAR_NUMBER_KERNEL(scalarGreater, greaterNumbers)
+SCALAR_NUMBER_KERNEL(scalarGreaterEqual, greaterEqualNumbers)
+SCALAR_NUMBER_KERNEL(scalarLess, lessNumbers)
+SCALAR_NUMBER_KERNEL(scalarLessEqual, lessEqualNumbers)
+
+static void scalarEqual(const double* a, const std::uint64_t* aTypes, const double* b, const std::uint64_t* bTypes,
+                        double* out, const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) out[i] = aTypes[i] == bTypes[i] && a[i] == b[i];
+}
+
+static void scalarNotEqual(const double* a, const std::uint64_t* aTypes, const double* b,
+                           const std::uint64_t* bTypes, double* out, const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) out[i] = !(aTypes[i] == bTypes[i] && a[i] == b[i]);
+}
+
+static void scalarFalsey(const double* a, const std::uint64_t* aTypes, double* out, const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) out[i] = aTypes[i] != LANE_NUMBER && a[i] == 0;
+}
+
+static void scalarNegate(const double* a, double* out, const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) out[i] = -a[i];
+}
+
+static void scalarMarkNonNumbers(const std::uint64_t* types, std::uint64_t* failed, const std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) failed[i] |= types[i];
+}
+
+#ifdef CLOXX_HAS_X86_SIMD
+
+// Comparisons give all-ones or all-zeros masks, which AND-ing with 1.0 turns
+// into the 1 or 0 the lanes hold.
+
+// Width lanes per step with vectorOp, then the rest with the scalar kernel.
+#define VECTOR_NUMBER_KERNEL(name, attributes, width, load, store, vectorOp, scalarKernel) \
+    attributes static void name(const double* a, const double* b, double* out, const std::size_t n) \
+    { \
+        std::size_t i = 0; \
+        for (; i + (width) <= n; i += (width)) store(out + i, vectorOp(load(a + i), load(b + i))); \
+        scalarKernel(a + i, b + i, out + i, n - i); \
+    }
+
+// SSE2 is part of x86-64, so these need no target attribute.
+
+static __m128i sse2LoadTypes(const std::uint64_t* types)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(types));
+}
+
+// SSE2 has no 64-bit compare: both halves of a lane must compare equal.
+static __m128d sse2EqualTypes(const __m128i a, const __m128i b)
+{
+    const __m128i halves = _mm_cmpeq_epi32(a, b);
+    return _mm_castsi128_pd(_mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1))));
+}
+
+static __m128d sse2Greater(const __m128d a, const __m128d b)
+{
+    return _mm_and_pd(_mm_cmpgt_pd(a, b), _mm_set1_pd(1));
+}
+
+static __m128d sse2GreaterEqual(const __m128d a, const __m128d b)
+{
+    return _mm_and_pd(_mm_cmpnlt_pd(a, b), _mm_set1_pd(1));
+}
+
+static __m128d sse2Less(const __m128d a, const __m128d b)
+{
+    return _mm_and_pd(_mm_cmplt_pd(a, b), _mm_set1_pd(1));
+}
+
+static __m128d sse2LessEqual(const __m128d a, const __m128d b)
+{
+    return _mm_and_pd(_mm_cmpngt_pd(a, b), _mm_set1_pd(1));
+}
+
+VECTOR_NUMBER_KERNEL(sse2Add, , 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, scalarAdd)
+VECTOR_NUMBER_KERNEL(sse2Subtract, , 2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd, scalarSubtract)
+VECTOR_NUMBER_KERNEL(sse2Multiply, , 2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, scalarMultiply)
+VECTOR_NUMBER_KERNEL(sse2Divide, , 2, _mm_loadu_pd, _mm_storeu_pd, _mm_div_pd, scalarDivide)
+VECTOR_NUMBER_KERNEL(sse2GreaterKernel, , 2, _mm_loadu_pd, _mm_storeu_pd, sse2Greater, scalarGreater)
+VECTOR_NUMBER_KERNEL(sse2GreaterEqualKernel, , 2, _mm_loadu_pd, _mm_storeu_pd, sse2GreaterEqual, scalarGreaterEqual)
+VECTOR_NUMBER_KERNEL(sse2LessKernel, , 2, _mm_loadu_pd, _mm_storeu_pd, sse2Less, scalarLess)
+VECTOR_NUMBER_KERNEL(sse2LessEqualKernel, , 2, _mm_loadu_pd, _mm_storeu_pd, sse2LessEqual, scalarLessEqual)
+
+static void sse2Equal(const double* a, const std::uint64_t* aTypes, const double* b, const std::uint64_t* bTypes,
+                      double* out, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        const __m128d same = _mm_and_pd(sse2EqualTypes(sse2LoadTypes(aTypes + i), sse2LoadTypes(bTypes + i)),
+                                        _mm_cmpeq_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        _mm_storeu_pd(out + i, _mm_and_pd(same, _mm_set1_pd(1)));
+    }
+    scalarEqual(a + i, aTypes + i, b + i, bTypes + i, out + i, n - i);
+}
+
+static void sse2NotEqual(const double* a, const std::uint64_t* aTypes, const double* b, const std::uint64_t* bTypes,
+                         double* out, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        const __m128d same = _mm_and_pd(sse2EqualTypes(sse2LoadTypes(aTypes + i), sse2LoadTypes(bTypes + i)),
+                                        _mm_cmpeq_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        _mm_storeu_pd(out + i, _mm_andnot_pd(same, _mm_set1_pd(1)));
+    }
+    scalarNotEqual(a + i, aTypes + i, b + i, bTypes + i, out + i, n - i);
+}
+
+static void sse2Falsey(const double* a, const std::uint64_t* aTypes, double* out, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        const __m128d number = sse2EqualTypes(sse2LoadTypes(aTypes + i), _mm_setzero_si128());
+        const __m128d zero = _mm_cmpeq_pd(_mm_loadu_pd(a + i), _mm_setzero_pd());
+        _mm_storeu_pd(out + i, _mm_and_pd(_mm_andnot_pd(number, zero), _mm_set1_pd(1)));
+    }
+    scalarFalsey(a + i, aTypes + i, out + i, n - i);
+}
+
+static void sse2Negate(const double* a, double* out, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        _mm_storeu_pd(out + i, _mm_xor_pd(_mm_loadu_pd(a + i), _mm_set1_pd(-0.0))); // Flips the sign bit.
+    }
+    scalarNegate(a + i, out + i, n - i);
+}
+
+static void sse2MarkNonNumbers(const std::uint64_t* types, std::uint64_t* failed, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        const __m128i marked = _mm_or_si128(sse2LoadTypes(failed + i), sse2LoadTypes(types + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(failed + i), marked);
+    }
+    scalarMarkNonNumbers(types + i, failed + i, n - i);
+}
+
+// AVX2 kernels are compiled for AVX2 only and selected after a CPUID check.
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static __m256i avx2LoadTypes(const std::uint64_t* types)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(types));
+}
+
+AVX2 static __m256d avx2EqualTypes(const __m256i a, const __m256i b)
+{
+    return _mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b));
+}
+
+AVX2 static __m256d avx2Greater(const __m256d a, const __m256d b)
+{
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ), _mm256_set1_pd(1));
+}
+
+AVX2 static __m256d avx2GreaterEqual(const __m256d a, const __m256d b)
+{
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_NLT_UQ), _mm256_set1_pd(1));
+}
+
+AVX2 static __m256d avx2Less(const __m256d a, const __m256d b)
+{
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ), _mm256_set1_pd(1));
+}
+
+AVX2 static __m256d avx2LessEqual(const __m256d a, const __m256d b)
+{
+    return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_NGT_UQ), _mm256_set1_pd(1));
+}
+
+VECTOR_NUMBER_KERNEL(avx2Add, AVX2, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, scalarAdd)
+VECTOR_NUMBER_KERNEL(avx2Subtract, AVX2, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd, scalarSubtract)
+VECTOR_NUMBER_KERNEL(avx2Multiply, AVX2, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, scalarMultiply)
+VECTOR_NUMBER_KERNEL(avx2Divide, AVX2, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_div_pd, scalarDivide)
+VECTOR_NUMBER_KERNEL(avx2GreaterKernel, AVX2, 4, _mm256_loadu_pd, _mm256_storeu_pd, avx2Greater, scalarGreater)
+VECTOR_NUMBER_KERNEL(avx2GreaterEqualKernel, AVX2, 4, _mm256_loadu_pd, _mm256_storeu_pd, avx2GreaterEqual,
+                     scalarGreaterEqual)
+VECTOR_NUMBER_KERNEL(avx2LessKernel, AVX2, 4, _mm256_loadu_pd, _mm256_storeu_pd, avx2Less, scalarLess)
+VECTOR_NUMBER_KERNEL(avx2LessEqualKernel, AVX2, 4, _mm256_loadu_pd, _mm256_storeu_pd, avx2LessEqual,
+                     scalarLessEqual)
+
+AVX2 static void avx2Equal(const double* a, const std::uint64_t* aTypes, const double* b,
+                           const std::uint64_t* bTypes, double* out, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256d same = _mm256_and_pd(avx2EqualTypes(avx2LoadTypes(aTypes + i), avx2LoadTypes(bTypes + i)),
+                                           _mm256_cmp_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _CMP_EQ_OQ));
+        _mm256_storeu_pd(out + i, _mm256_and_pd(same, _mm256_set1_pd(1)));
+    }
+    scalarEqual(a + i, aTypes + i, b + i, bTypes + i, out + i, n - i);
+}
+
+AVX2 static void avx2NotEqual(const double* a, const std::uint64_t* aTypes, const double* b,
+                              const std::uint64_t* bTypes, double* out, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256d same = _mm256_and_pd(avx2EqualTypes(avx2LoadTypes(aTypes + i), avx2LoadTypes(bTypes + i)),
+                                           _mm256_cmp_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _CMP_EQ_OQ));
+        _mm256_storeu_pd(out + i, _mm256_andnot_pd(same, _mm256_set1_pd(1)));
+    }
+    scalarNotEqual(a + i, aTypes + i, b + i, bTypes + i, out + i, n - i);
+}
+
+AVX2 static void avx2Falsey(const double* a, const std::uint64_t* aTypes, double* out, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256d number = avx2EqualTypes(avx2LoadTypes(aTypes + i), _mm256_setzero_si256());
+        const __m256d zero = _mm256_cmp_pd(_mm256_loadu_pd(a + i), _mm256_setzero_pd(), _CMP_EQ_OQ);
+        _mm256_storeu_pd(out + i, _mm256_and_pd(_mm256_andnot_pd(number, zero), _mm256_set1_pd(1)));
+    }
+    scalarFalsey(a + i, aTypes + i, out + i, n - i);
+}
+
+AVX2 static void avx2Negate(const double* a, double* out, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(out + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), _mm256_set1_pd(-0.0)));
+    }
+    scalarNegate(a + i, out + i, n - i);
+}
+
+AVX2 static void avx2MarkNonNumbers(const std::uint64_t* types, std::uint64_t* failed, const std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256i marked = _mm256_or_si256(avx2LoadTypes(failed + i), avx2LoadTypes(types + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(failed + i), marked);
+    }
+    scalarMarkNonNumbers(types + i, failed + i, n - i);
+}
+
+#undef AVX2
+#undef VECTOR_NUMBER_KERNEL
+
+#endif
+
+#undef SCALAR_NUMBER_KERNEL
+
+static constexpr ColumnKernels scalarKernels =
+{
+    scalarAdd,
+    scalarSubtract,
+    scalarMultiply,
+    scalarDivide,
+    scalarGreater,
+    scalarGreaterEqual,
+    scalarLess,
+    scalarLessEqual,
+    scalarEqual,
+    scalarNotEqual,
+    scalarFalsey,
+    scalarNegate,
+    scalarMarkNonNumbers,
+};
+
+#ifdef CLOXX_HAS_X86_SIMD
+static constexpr ColumnKernels sse2Kernels =
+{
+    sse2Add,
+    sse2Subtract,
+    sse2Multiply,
+    sse2Divide,
+    sse2GreaterKernel,
+    sse2GreaterEqualKernel,
+    sse2LessKernel,
+    sse2LessEqualKernel,
+    sse2Equal,
+    sse2NotEqual,
+    sse2Falsey,
+    sse2Negate,
+    sse2MarkNonNumbers,
+};
+
+static constexpr ColumnKernels avx2Kernels =
+{
+    avx2Add,
+    avx2Subtract,
+    avx2Multiply,
+    avx2Divide,
+    avx2GreaterKernel,
+    avx2GreaterEqualKernel,
+    avx2LessKernel,
+    avx2LessEqualKernel,
+    avx2Equal,
+    avx2NotEqual,
+    avx2Falsey,
+    avx2Negate,
+    avx2MarkNonNumbers,
+};
+#endif
+
+bool isColumnKernelAvailable(const ColumnKernel kernel)
+{
+    switch (kernel)
+    {
+    case COLUMN_SCALAR:
+        return true;
+#ifdef CLOXX_HAS_X86_SIMD
+    case COLUMN_SSE2:
+        return true;
+    case COLUMN_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+ColumnKernel bestColumnKernel()
+{
+    static const ColumnKernel best =
+        isColumnKernelAvailable(COLUMN_AVX2) ? COLUMN_AVX2 :
+        isColumnKernelAvailable(COLUMN_SSE2) ? COLUMN_SSE2 :
+        COLUMN_SCALAR;
+    return best;
+}
+
+const ColumnKernels& getColumnKernels(const ColumnKernel kernel)
+{
+    if (!isColumnKernelAvailable(kernel))
+    {
+        return scalarKernels;
+    }
+
+    switch (kernel)
+    {
+#ifdef CLOXX_HAS_X86_SIMD
+    case COLUMN_SSE2:   return sse2Kernels;
+    case COLUMN_AVX2:   return avx2Kernels;
+#endif
+    default:            return scalarKernels;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Instruction kernels of ColumnVM, each available as a scalar loop and as
+// vectorized loops that process 2 (SSE2) or 4 (AVX2) lanes per step. A lane
+// holds one row's value as a number and a type: bools are stored as the
+// numbers 1 and 0, nil as 0.
+enum ColumnKernel: std::uint8_t
+{
+    COLUMN_SCALAR,
+    COLUMN_SSE2,
+    COLUMN_AVX2,
+};
+
+// Numbers are 0, so OR-ing the types of some lanes gives 0 only when all of
+// them hold numbers.
+enum LaneType: std::uint64_t
+{
+    LANE_NUMBER = 0,
+    LANE_BOOL = 1,
+    LANE_NIL = 2,
+};
+
+using NumberKernel = void (*)(const double* a, const double* b, double* out, std::size_t n);
+using EqualityKernel = void (*)(const double* a, const std::uint64_t* aTypes, const double* b,
+                                const std::uint64_t* bTypes, double* out, std::size_t n);
+
+// Every kernel works on n lanes, and out may be one of its inputs.
+struct ColumnKernels
+{
+    // out = a op b.
+    NumberKernel add;
+    NumberKernel subtract;
+    NumberKernel multiply;
+    NumberKernel divide;
+    // out = 1 or 0. >= and <= negate < and > like the VM, so NaN compares the same.
+    NumberKernel greater;
+    NumberKernel greaterEqual;
+    NumberKernel less;
+    NumberKernel lessEqual;
+    // out = 1 where a and b have the same type and number, 0 elsewhere, or the reverse.
+    EqualityKernel equal;
+    EqualityKernel notEqual;
+    // out = 1 where a is nil or false, 0 elsewhere.
+    void (*falsey)(const double* a, const std::uint64_t* aTypes, double* out, std::size_t n);
+    // out = -a.
+    void (*negate)(const double* a, double* out, std::size_t n);
+    // failed |= types, which leaves failed non-zero in the lanes that hold no number.
+    void (*markNonNumbers)(const std::uint64_t* types, std::uint64_t* failed, std::size_t n);
+};
+
+bool isColumnKernelAvailable(ColumnKernel kernel);
+ColumnKernel bestColumnKernel();                            // Picked once from CPUID.
+const ColumnKernels& getColumnKernels(ColumnKernel kernel); // Unavailable kernels fall back to scalar.
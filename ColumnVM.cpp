@@ -0,0 +1,367 @@
+#include "ColumnVM.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "Chunk.h"
+#include "Value.h"
+
+ColumnVM::ColumnVM()
+    : kernel(bestColumnKernel())
+    , kernels(&getColumnKernels(kernel))
+{
+    rowVM.setErrorOutput(&rowErrors);
+}
+
+void ColumnVM::setKernel(const ColumnKernel k)
+{
+    // Kernels the CPU lacks fall back to the scalar ones.
+    kernel = isColumnKernelAvailable(k) ? k : COLUMN_SCALAR;
+    kernels = &getColumnKernels(kernel);
+}
+
+void ColumnVM::bindNumbers(const std::size_t input, const std::span<const double> column)
+{
+    if (columns.size() <= input) columns.resize(input + 1);
+    columns[input] = Column{column.data(), nullptr, column.size()};
+}
+
+void ColumnVM::bindValues(const std::size_t input, const std::span<const Value> column)
+{
+    if (columns.size() <= input) columns.resize(input + 1);
+    columns[input] = Column{nullptr, column.data(), column.size()};
+}
+
+InterpretResult ColumnVM::run(const CompiledChunk& chunk, const std::size_t rows, ColumnResults* results)
+{
+    if (!chunk.isValid())
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+    return run(chunk.view(), rows, results);
+}
+
+InterpretResult ColumnVM::run(const ChunkView& chunk, const std::size_t rows, ColumnResults* results)
+{
+    std::size_t depth = 0;
+    bool byRows = false;
+    if (!prepare(chunk, rows, &depth, &byRows))
+    {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    if (stack.size() < depth)
+    {
+        stack.resize(depth);
+    }
+
+    results->values.assign(rows, NIL_VAL);
+    results->failed.assign((rows + 63) / 64, 0);
+    results->failures = 0;
+    rowVM.setExtraRoots(results->values); // Strings of the rows already run.
+
+    for (std::size_t start = 0; start < rows; start += COLUMN_LANES)
+    {
+        const std::size_t count = std::min(COLUMN_LANES, rows - start);
+        if (byRows || !runBlock(chunk, start, count, results))
+        {
+            runRows(chunk, start, count, results);
+        }
+    }
+    return INTERPRET_OK;
+}
+
+// Checks the code once for the whole run, so that blocks run without checks,
+// and measures the stack it needs. Code is straight-line, so every instruction
+// runs once with a known stack depth. Sets byRows for code that lanes cannot
+// run: string constants, and globals, which rows share.
+bool ColumnVM::prepare(const ChunkView& chunk, const std::size_t rows, std::size_t* depth, bool* byRows)
+{
+    std::size_t height = 0;
+    for (std::size_t offset = 0; offset < chunk.code.size();)
+    {
+        const std::uint8_t instruction = chunk.code[offset];
+        if (instruction >= OP_COUNT || offset + instructionLength(instruction) > chunk.code.size())
+        {
+            error("Invalid instruction at offset %zu.", offset);
+            return false;
+        }
+
+        const std::uint8_t operation = checkedOpcode(genericOpcode(instruction));
+        const std::size_t pops = operation == OP_RETURN || operation == OP_NOT || operation == OP_NEGATE ||
+                                 operation == OP_POP || operation == OP_DEFINE_GLOBAL_SLOT ||
+                                 operation == OP_SET_GLOBAL_SLOT ? 1
+                               : operation >= OP_EQUAL && operation <= OP_DIVIDE ? 2 : 0;
+        const std::size_t pushes = operation == OP_POP || operation == OP_DEFINE_GLOBAL_SLOT ? 0 : 1;
+        if (height < pops)
+        {
+            error("Stack underflow at offset %zu.", offset);
+            return false;
+        }
+
+        switch (operation)
+        {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        {
+            const std::uint32_t index = operation == OP_CONSTANT ? chunk.code[offset + 1]
+                                                                 : readLongOperand(&chunk.code[offset + 1]);
+            if (index >= chunk.constants.size())
+            {
+                error("Invalid constant at offset %zu.", offset);
+                return false;
+            }
+            *byRows = *byRows || IS_STRING(chunk.constants[index]);
+            break;
+        }
+        case OP_INPUT:
+        {
+            const std::uint8_t input = chunk.code[offset + 1];
+            if (input >= columns.size() || (columns[input].numbers == nullptr && columns[input].values == nullptr))
+            {
+                error("Input %d is not bound.", input);
+                return false;
+            }
+            if (columns[input].rows < rows)
+            {
+                error("Input %d has %zu rows, %zu needed.", input, columns[input].rows, rows);
+                return false;
+            }
+            break;
+        }
+        case OP_DEFINE_GLOBAL_SLOT:
+        case OP_GET_GLOBAL_SLOT:
+        case OP_SET_GLOBAL_SLOT:
+            if (chunk.code[offset + 1] >= chunk.globals.size())
+            {
+                error("Invalid global at offset %zu.", offset);
+                return false;
+            }
+            *byRows = true;
+            break;
+        case OP_RETURN:
+            return true;
+        default: ;
+        }
+
+        height = height - pops + pushes;
+        *depth = std::max(*depth, height);
+        offset += instructionLength(instruction);
+    }
+
+    error("Missing return.");
+    return false;
+}
+
+// Fails for strings, which have no lane.
+static bool storeLane(const Value& value, double* number, std::uint64_t* type)
+{
+    if (IS_NUMBER(value))
+    {
+        *number = AS_NUMBER(value);
+        *type = LANE_NUMBER;
+    }
+    else if (IS_BOOL(value))
+    {
+        *number = AS_BOOL(value) ? 1 : 0;
+        *type = LANE_BOOL;
+    }
+    else if (IS_NIL(value))
+    {
+        *number = 0;
+        *type = LANE_NIL;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static Value loadLane(const double number, const std::uint64_t type)
+{
+    switch (type)
+    {
+    case LANE_NUMBER:   return NUMBER_VAL(number);
+    case LANE_BOOL:     return BOOL_VAL(number != 0);
+    default:            return NIL_VAL;
+    }
+}
+
+// Leaves the result in the slot of a, the one below top.
+void ColumnVM::binary(Lanes* top, const NumberKernel op, const LaneType type, const bool checked,
+                      const std::size_t count)
+{
+    Lanes* const a = top - 2;
+    const Lanes* const b = top - 1;
+    if (checked)
+    {
+        kernels->markNonNumbers(a->types, failed.data(), count);
+        kernels->markNonNumbers(b->types, failed.data(), count);
+    }
+    op(a->numbers, b->numbers, a->numbers, count);
+    std::fill_n(a->types, count, type);
+}
+
+// Runs rows [start, start + count) through code that prepare() accepted. The
+// lanes of failed rows keep running on whatever they hold, and are discarded
+// at the end. Fails without storing any result if an input holds a string.
+bool ColumnVM::runBlock(const ChunkView& chunk, const std::size_t start, const std::size_t count,
+                        ColumnResults* results)
+{
+    std::fill_n(failed.begin(), count, 0);
+    Lanes* top = stack.data(); // Next free slot.
+
+    const auto push = [&](const Value& value)
+    {
+        double number;
+        std::uint64_t type;
+        storeLane(value, &number, &type); // Constants are no strings, prepare() saw to it.
+        std::fill_n(top->numbers, count, number);
+        std::fill_n(top->types, count, type);
+        top++;
+    };
+
+    for (std::size_t offset = 0;;)
+    {
+        const std::uint8_t instruction = chunk.code[offset];
+        // Quickened forms check like the generic ones, unchecked forms do not.
+        const std::uint8_t generic = genericOpcode(instruction);
+        const std::uint8_t operation = checkedOpcode(generic);
+        const bool checked = operation == generic;
+
+        switch (operation)
+        {
+        case OP_CONSTANT:       push(chunk.constants[chunk.code[offset + 1]]); break;
+        case OP_CONSTANT_LONG:  push(chunk.constants[readLongOperand(&chunk.code[offset + 1])]); break;
+        case OP_NIL:            push(NIL_VAL); break;
+        case OP_TRUE:           push(BOOL_VAL(true)); break;
+        case OP_FALSE:          push(BOOL_VAL(false)); break;
+        case OP_POP:            top--; break;
+        case OP_INPUT:
+        {
+            const Column& column = columns[chunk.code[offset + 1]];
+            if (column.numbers != nullptr)
+            {
+                std::memcpy(top->numbers, column.numbers + start, count * sizeof(double));
+                std::fill_n(top->types, count, LANE_NUMBER);
+            }
+            else
+            {
+                for (std::size_t i = 0; i < count; i++)
+                {
+                    if (!storeLane(column.values[start + i], &top->numbers[i], &top->types[i]))
+                    {
+                        return false;
+                    }
+                }
+            }
+            top++;
+            break;
+        }
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        {
+            const EqualityKernel op = operation == OP_EQUAL ? kernels->equal : kernels->notEqual;
+            Lanes& a = top[-2];
+            const Lanes& b = top[-1];
+            op(a.numbers, a.types, b.numbers, b.types, a.numbers, count);
+            std::fill_n(a.types, count, LANE_BOOL);
+            top--;
+            break;
+        }
+        case OP_GREATER:        binary(top, kernels->greater, LANE_BOOL, checked, count); top--; break;
+        case OP_GREATER_EQUAL:  binary(top, kernels->greaterEqual, LANE_BOOL, checked, count); top--; break;
+        case OP_LESS:           binary(top, kernels->less, LANE_BOOL, checked, count); top--; break;
+        case OP_LESS_EQUAL:     binary(top, kernels->lessEqual, LANE_BOOL, checked, count); top--; break;
+        case OP_ADD:            binary(top, kernels->add, LANE_NUMBER, checked, count); top--; break;
+        case OP_SUBTRACT:       binary(top, kernels->subtract, LANE_NUMBER, checked, count); top--; break;
+        case OP_MULTIPLY:       binary(top, kernels->multiply, LANE_NUMBER, checked, count); top--; break;
+        case OP_DIVIDE:         binary(top, kernels->divide, LANE_NUMBER, checked, count); top--; break;
+        case OP_NOT:
+            kernels->falsey(top[-1].numbers, top[-1].types, top[-1].numbers, count);
+            std::fill_n(top[-1].types, count, LANE_BOOL);
+            break;
+        case OP_NEGATE:
+            if (checked)
+            {
+                kernels->markNonNumbers(top[-1].types, failed.data(), count);
+            }
+            kernels->negate(top[-1].numbers, top[-1].numbers, count);
+            std::fill_n(top[-1].types, count, LANE_NUMBER);
+            break;
+        case OP_RETURN:
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const std::size_t row = start + i;
+                if (failed[i] != 0)
+                {
+                    results->failed[row / 64] |= std::uint64_t{1} << (row % 64);
+                    results->failures++;
+                }
+                else
+                {
+                    results->values[row] = loadLane(top[-1].numbers[i], top[-1].types[i]);
+                }
+            }
+            return true;
+        default:
+            return true; // Unreachable, prepare() accepted the code.
+        }
+
+        offset += instructionLength(instruction);
+    }
+}
+
+// The slow path for what lanes cannot hold: one VM run per row.
+void ColumnVM::runRows(const ChunkView& chunk, const std::size_t start, const std::size_t count,
+                       ColumnResults* results)
+{
+    rowInputs.assign(columns.size(), NIL_VAL);
+    rowVM.setInputs(rowInputs);
+    for (std::size_t row = start; row < start + count; row++)
+    {
+        for (std::size_t input = 0; input < columns.size(); input++)
+        {
+            // Columns the chunk does not read may be unbound or shorter.
+            const Column& column = columns[input];
+            if (row < column.rows)
+            {
+                rowInputs[input] = column.numbers != nullptr ? NUMBER_VAL(column.numbers[row]) : column.values[row];
+            }
+        }
+
+        rowErrors.clear();
+        if (rowVM.interpret(chunk) == INTERPRET_OK)
+        {
+            results->values[row] = rowVM.lastResult();
+        }
+        else
+        {
+            results->failed[row / 64] |= std::uint64_t{1} << (row % 64);
+            results->failures++;
+        }
+    }
+}
+
+void ColumnVM::error(const char* format, ...)
+{
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    const std::string text = std::string(message) + "\n";
+    if (errors != nullptr)
+    {
+        errors->append(text);
+    }
+    else
+    {
+        fputs(text.c_str(), stderr);
+    }
+}
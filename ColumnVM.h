@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Chunk.h"
+#include "ColumnKernels.h"
+#include "CompiledChunk.h"
+#include "Value.h"
+#include "VM.h"
+
+constexpr std::size_t COLUMN_LANES = 256; // Rows each instruction processes at once.
+
+// Outcome of a chunk over every row. A row whose run would have raised a
+// runtime error is marked failed instead of stopping the others; running that
+// row through a VM gives its error message.
+struct ColumnResults
+{
+    std::vector<Value> values;          // One per row, nil for the failed ones.
+    std::vector<std::uint64_t> failed;  // Bit row % 64 of word row / 64 is set for each failed row.
+    std::size_t failures = 0;
+
+    bool hasFailed(const std::size_t row) const { return (failed[row / 64] >> (row % 64) & 1) != 0; }
+};
+
+// Runs a chunk over columns of inputs, COLUMN_LANES rows at a time: each stack
+// slot holds a value for every row, and each instruction runs a kernel over all
+// of them. Gives the same values as running the chunk once per row through a
+// VM bound to the inputs of that row. Like a VM, it runs one chunk at a time.
+// Strings have no lanes: a chunk with string constants or globals, or a block
+// reading a string input, runs row by row through a VM instead. Its globals
+// carry over from one row to the next, and the strings it builds stay valid
+// until the next run of the ColumnVM.
+class ColumnVM
+{
+public:
+    ColumnVM();
+
+    // Binds the column of the input at index, its position in
+    // CompilerOptions::inputs. The column must outlive the runs reading it.
+    void bindNumbers(std::size_t input, std::span<const double> column);
+    void bindValues(std::size_t input, std::span<const Value> column);
+    void unbindAll() { columns.clear(); }
+
+    // Runs the chunk for the first rows rows of the bound columns. Fails before
+    // running any row if the chunk reads an input that is unbound or shorter.
+    InterpretResult run(const CompiledChunk& chunk, std::size_t rows, ColumnResults* results);
+    InterpretResult run(const ChunkView& chunk, std::size_t rows, ColumnResults* results);
+
+    void setKernel(ColumnKernel kernel);
+    ColumnKernel getKernel() const { return kernel; }
+
+    // Appends errors to buffer instead of printing them to stderr.
+    void setErrorOutput(std::string* buffer) { errors = buffer; }
+
+private:
+    // One stack slot: the value of every row of the block as a lane.
+    struct Lanes
+    {
+        alignas(32) double numbers[COLUMN_LANES];
+        alignas(32) std::uint64_t types[COLUMN_LANES];
+    };
+
+    // Exactly one of numbers and values is set.
+    struct Column
+    {
+        const double* numbers = nullptr;
+        const Value* values = nullptr;
+        std::size_t rows = 0;
+    };
+
+    std::vector<Column> columns;
+    std::vector<Lanes> stack;
+    alignas(32) std::array<std::uint64_t, COLUMN_LANES> failed{}; // Non-zero for the failed lanes of the block.
+    ColumnKernel kernel;
+    const ColumnKernels* kernels;
+    std::string* errors = nullptr;
+    VM rowVM;                       // Runs the rows that lanes cannot hold.
+    std::vector<Value> rowInputs;
+    std::string rowErrors;          // Of rowVM, dropped: the row is only marked failed.
+
+    bool prepare(const ChunkView& chunk, std::size_t rows, std::size_t* depth, bool* byRows);
+    bool runBlock(const ChunkView& chunk, std::size_t start, std::size_t count, ColumnResults* results);
+    void runRows(const ChunkView& chunk, std::size_t start, std::size_t count, ColumnResults* results);
+    void binary(Lanes* top, NumberKernel op, LaneType type, bool checked, std::size_t count);
+    void error(const char* format, ...);
+};
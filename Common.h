@@ -1,4 +1,34 @@
 #pragma once
 
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
\ No newline at end of file
+// Computed goto ("goto *label") is a GNU extension supported by GCC and Clang.
+#if defined(__GNUC__) || defined(__clang__)
+#define CLOXX_HAS_COMPUTED_GOTO
+#endif
+
+// The profiler reads the time stamp counter when there is one.
+#if defined(__x86_64__) || defined(__i386__)
+#define CLOXX_HAS_RDTSC
+#endif
+
+// The baseline JIT emits x86-64 code for the System V calling convention into
+// pages from mmap.
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define CLOXX_HAS_JIT
+#endif
+
+// Guaranteed tail calls are required for the tail-call dispatch engine, otherwise
+// every executed instruction would grow the native stack.
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::musttail)
+#define CLOXX_HAS_MUSTTAIL
+#endif
+#endif
+
+// Default dispatch engine, overridable from CMake with CLOXX_DISPATCH.
+#ifndef CLOXX_DEFAULT_DISPATCH
+#if defined(CLOXX_HAS_COMPUTED_GOTO)
+#define CLOXX_DEFAULT_DISPATCH DISPATCH_COMPUTED_GOTO
+#else
+#define CLOXX_DEFAULT_DISPATCH DISPATCH_SWITCH
+#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "CompiledChunk.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Chunk.h"
+#include "Compiler.h"
+#include "Jit.h"
+#include "Source.h"
+
+struct CompiledChunk::JitState
+{
+    std::atomic<std::uint32_t> runs = 0;
+    std::once_flag compiled;
+    std::unique_ptr<JitCode> code;
+    std::atomic<const JitCode*> ready = nullptr; // Code, once compiled.
+};
+
+// Stops counting once hot, so that VMs on several threads do not keep writing
+// the same cache line.
+const JitCode* CompiledChunk::hotJitCode() const
+{
+    if (jit == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (const JitCode* code = jit->ready.load(std::memory_order_acquire))
+    {
+        return code;
+    }
+    if (jit->runs.load(std::memory_order_relaxed) < JIT_HOT_RUNS &&
+        jit->runs.fetch_add(1, std::memory_order_relaxed) + 1 < JIT_HOT_RUNS)
+    {
+        return nullptr;
+    }
+
+    std::call_once(jit->compiled, [this]
+    {
+        jit->code = JitCode::compile(chunk->view());
+        jit->ready.store(jit->code.get(), std::memory_order_release);
+    });
+    return jit->code.get();
+}
+
+CompiledChunk compile(const Source& source, const CompilerOptions& options)
+{
+    CompiledChunk compiled;
+
+    auto chunk = std::make_shared<Chunk>();
+    Compiler compiler(options);
+    compiler.setErrorOutput(&compiled.diagnostics);
+    if (!compiler.compile(source, chunk.get()))
+    {
+        return compiled;
+    }
+
+    // The compiler reserves for the worst case; a long-lived chunk keeps only what it uses.
+    chunk->code.shrink_to_fit();
+    chunk->lines.shrink_to_fit();
+    chunk->constants.values.shrink_to_fit();
+
+    compiled.chunk = std::move(chunk);
+    if (JitCode::isAvailable())
+    {
+        compiled.jit = std::make_shared<CompiledChunk::JitState>();
+    }
+    return compiled;
+}
+
+CompiledChunk compile(const std::string& text, const CompilerOptions& options)
+{
+    return compile(Source(text), options);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "Chunk.h"
+#include "Compiler.h"
+#include "Source.h"
+
+class JitCode;
+
+// A chunk compiled once and run any number of times. It is immutable and copies
+// share it, so one CompiledChunk can be run by several VMs on several threads at
+// once. A chunk that failed to compile is empty and keeps the diagnostics.
+class CompiledChunk
+{
+public:
+    CompiledChunk() = default;
+
+    bool isValid() const { return chunk != nullptr; }
+    const std::string& errors() const { return diagnostics; }
+    ChunkView view() const { return chunk != nullptr ? chunk->view() : ChunkView{}; }
+
+    // Counts one run. Once the chunk has run JIT_HOT_RUNS times it is compiled
+    // to machine code, shared by all copies; null until then, or if the JIT
+    // cannot compile it.
+    const JitCode* hotJitCode() const;
+
+private:
+    struct JitState;
+
+    std::shared_ptr<const Chunk> chunk;
+    std::shared_ptr<JitState> jit; // Shared by copies, like chunk.
+    std::string diagnostics;
+
+    friend CompiledChunk compile(const Source& source, const CompilerOptions& options);
+};
+
+// Compile errors are collected in the result instead of printed.
+CompiledChunk compile(const Source& source, const CompilerOptions& options = CompilerOptions{});
+CompiledChunk compile(const std::string& text, const CompilerOptions& options = CompilerOptions{});
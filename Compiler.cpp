@@ -1,9 +1,11 @@
 #include "Compiler.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <climits>
 #include <iostream>
 
@@ -11,26 +13,74 @@
 #include "Source.h"
 #include "Chunk.h"
 #include "Value.h"
-#include "Common.h"
-
-#ifdef DEBUG_PRINT_CODE
+#include "Object.h"
+#include "Heap.h"
+#include "Peephole.h"
 #include "Debug.h"
-#endif
 
 bool Compiler::compile(const Source& source, Chunk* c)
 {
     scanner = Scanner(source);
     parser.hadError = false;
     parser.panicMode = false;
+    exprType = TYPE_UNKNOWN;
 
     chunk = c;
+    pool.emplace(chunk->resource());
+    reserveChunk(source.size());
     advance();
-    expression();
+
+    // Declarations and statements, then optionally an expression without a
+    // semicolon: the value of the script, which is otherwise nil.
+    bool result = false;
+    while (!result && parser.current.type != TOKEN_EOF)
+    {
+        result = declaration();
+        if (parser.panicMode)
+        {
+            synchronize();
+            result = false;
+        }
+    }
+    if (!result)
+    {
+        emitByte(OP_NIL);
+    }
     consume(TokenType::TOKEN_EOF, "Expect end of expression.");
     endCompiler();
     return !parser.hadError;
 }
 
+// Every token is at least one character. A literal emits at most four bytes,
+// as OP_CONSTANT_LONG, and is followed by another token emitting at most one,
+// so the code never outgrows two and a half times the source, plus the final
+// OP_NIL and OP_RETURN. Reserving it up front spares the arena the abandoned
+// buffers of a growing vector.
+static std::size_t maxCodeBytes(const std::size_t sourceSize)
+{
+    return sourceSize * 2 + sourceSize / 2 + 4;
+}
+
+// One per literal, which is followed by at least one other token.
+static std::size_t maxConstants(const std::size_t sourceSize)
+{
+    return std::min<std::size_t>(MAX_CONSTANTS, sourceSize / 2 + 1);
+}
+
+std::size_t Compiler::arenaBytes(const std::size_t sourceSize)
+{
+    // Code and constants, then the peephole pass: a second copy of the code and
+    // the offset of every instruction.
+    const std::size_t code = maxCodeBytes(sourceSize);
+    return code * (2 + sizeof(std::size_t)) + maxConstants(sourceSize) * sizeof(Value) + 4096;
+}
+
+void Compiler::reserveChunk(const std::size_t sourceSize) const
+{
+    chunk->code.reserve(maxCodeBytes(sourceSize));
+    chunk->constants.values.reserve(maxConstants(sourceSize));
+}
+
 void Compiler::advance()
 {
     parser.previous = parser.current;
@@ -58,6 +108,17 @@ void Compiler::consume(TokenType type, const std::string& message)
     errorAtCurrent(message);
 }
 
+bool Compiler::match(const TokenType type)
+{
+    if (parser.current.type != type)
+    {
+        return false;
+    }
+
+    advance();
+    return true;
+}
+
 void Compiler::emitByte(const std::uint8_t byte) const {
     chunk->writeChunk(byte, parser.previous.line);
 }
@@ -71,31 +132,153 @@ void Compiler::emitReturn() const {
     emitByte(OP_RETURN);
 }
 
+// The first 256 entries keep the two-byte encoding, the rest need OP_CONSTANT_LONG.
 void Compiler::emitConstant(const Value value)
 {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    const std::uint32_t constant = makeConstant(value);
+    if (constant <= UCHAR_MAX)
+    {
+        emitBytes(OP_CONSTANT, static_cast<std::uint8_t>(constant));
+        return;
+    }
+
+    emitBytes(OP_CONSTANT_LONG, static_cast<std::uint8_t>(constant));
+    emitBytes(static_cast<std::uint8_t>(constant >> 8), static_cast<std::uint8_t>(constant >> 16));
+}
+
+Value Compiler::internString(const char* chars, const std::size_t length) const
+{
+    return options.heap != nullptr ? options.heap->makeString(chars, length) : makeString(chars, length);
 }
 
-std::uint8_t Compiler::makeConstant(const Value value)
+// Returns the pool entry of value, adding it unless an identical value is
+// already there, and counts the load about to be emitted.
+std::uint32_t Compiler::makeConstant(const Value value)
 {
-    const int constant = chunk->addConstant(value);
-    if (constant > UCHAR_MAX)
+    const std::size_t count = chunk->constants.values.size();
+    const auto slot = pool->slots.find(valueBits(value));
+    if (slot != pool->slots.end() && valuesIdentical(chunk->constants.values[slot->second], value))
+    {
+        pool->loads[slot->second]++;
+        return slot->second;
+    }
+
+    if (count >= MAX_CONSTANTS)
     {
         error("Too many constants in one chunk.");
         return 0;
     }
 
-    return static_cast<std::uint8_t>(constant);
+    // A value of another type with the same bits keeps the slot, this one is not shared.
+    if (slot == pool->slots.end())
+    {
+        pool->slots.emplace(valueBits(value), static_cast<std::uint32_t>(count));
+    }
+    chunk->addConstant(value);
+    pool->loads.push_back(1);
+    return static_cast<std::uint32_t>(count);
+}
+
+// Pool index of the constant load at start.
+std::uint32_t Compiler::loadedConstant(const std::size_t start) const
+{
+    return chunk->code[start] == OP_CONSTANT ? chunk->code[start + 1] : readLongOperand(&chunk->code[start + 1]);
+}
+
+// Reads the value loaded by the code in [start, end), if that code is a single
+// constant load. Folding collapses every constant subexpression into one load,
+// so this is enough to recognize constant operands of any depth.
+bool Compiler::readConstantLoad(const std::size_t start, const std::size_t end, Value* value) const
+{
+    const std::size_t length = end - start;
+    if (length == 0)
+    {
+        return false;
+    }
+
+    switch (chunk->code[start])
+    {
+    case OP_NIL:    *value = NIL_VAL; return length == 1;
+    case OP_TRUE:   *value = BOOL_VAL(true); return length == 1;
+    case OP_FALSE:  *value = BOOL_VAL(false); return length == 1;
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+        if (length != instructionLength(chunk->code[start]))
+        {
+            return false;
+        }
+        *value = chunk->constants.values[loadedConstant(start)];
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Removes the constant load at start, which must be the last emitted
+// instruction. Pool entries left without loads are dropped from the end of the
+// pool, so folding does not fill it with intermediate results.
+void Compiler::discardConstantLoad(const std::size_t start)
+{
+    const std::uint8_t instruction = chunk->code[start];
+    if (instruction == OP_CONSTANT || instruction == OP_CONSTANT_LONG)
+    {
+        pool->loads[loadedConstant(start)]--;
+
+        std::pmr::vector<Value>& constants = chunk->constants.values;
+        while (!constants.empty() && pool->loads.back() == 0)
+        {
+            const auto slot = pool->slots.find(valueBits(constants.back()));
+            if (slot != pool->slots.end() && slot->second == constants.size() - 1)
+            {
+                pool->slots.erase(slot);
+            }
+            constants.pop_back();
+            pool->loads.pop_back();
+        }
+    }
+
+    chunk->truncate(start);
+}
+
+void Compiler::emitFolded(const Value value)
+{
+    if (IS_NIL(value))
+    {
+        emitByte(OP_NIL);
+        exprType = TYPE_NIL;
+    }
+    else if (IS_BOOL(value))
+    {
+        emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+        exprType = TYPE_BOOL;
+    }
+    else
+    {
+        emitConstant(value);
+        exprType = IS_STRING(value) ? TYPE_STRING : TYPE_NUMBER;
+    }
+}
+
+// An instruction that checks its operands are numbers, unchecked when they are
+// known to be. Either way its result is a number or a bool, except for OP_ADD
+// which also concatenates strings: a failed check stops the script.
+void Compiler::emitArithmetic(const std::uint8_t instruction, const bool numberOperands)
+{
+    emitByte(numberOperands && options.inferTypes ? uncheckedOpcode(instruction) : instruction);
 }
 
 void Compiler::endCompiler() const {
     emitReturn();
 
-#ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
-        disassembleChunk(*chunk, "code");
+    if (options.peephole && !parser.hadError)
+    {
+        optimizeChunk(*chunk);
+    }
+
+    if (options.dumpBytecode && !parser.hadError) {
+        disassembleChunk(chunk->view(), "code");
+        printOperandChecks(chunk->view());
     }
-#endif
 }
 
 void Compiler::expression()
@@ -103,22 +286,174 @@ void Compiler::expression()
     parsePrecedence(ASSIGNMENT);
 }
 
+// Returns true for an expression left without its semicolon, which must end
+// the script and gives its value.
+bool Compiler::declaration()
+{
+    if (match(TOKEN_VAR))
+    {
+        varDeclaration();
+        return false;
+    }
+
+    expression();
+    if (!match(TOKEN_SEMICOLON))
+    {
+        return true;
+    }
+    emitByte(OP_POP);
+    return false;
+}
+
+void Compiler::varDeclaration()
+{
+    consume(TOKEN_IDENTIFIER, "Expect variable name.");
+    const Token name = parser.previous;
+    if (std::find(options.inputs.begin(), options.inputs.end(), std::string_view(name.start, name.length)) !=
+        options.inputs.end())
+    {
+        error("Already an input with this name.");
+        return;
+    }
+    const std::uint8_t slot = globalSlot(name);
+
+    if (match(TOKEN_EQUAL))
+    {
+        expression();
+    }
+    else
+    {
+        emitByte(OP_NIL);
+    }
+    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    emitBytes(OP_DEFINE_GLOBAL_SLOT, slot);
+}
+
+// Slot of a global in this chunk, numbered in order of first mention. The VM
+// maps the slots of each chunk to its own by name once, so that chunks share
+// their globals and instructions never look a name up.
+std::uint8_t Compiler::globalSlot(const Token& name)
+{
+    const Value string = internString(name.start, name.length);
+    const auto found = pool->globals.find(valueBits(string));
+    if (found != pool->globals.end())
+    {
+        return found->second;
+    }
+
+    if (chunk->globals.size() >= MAX_GLOBALS)
+    {
+        error("Too many globals in one chunk.");
+        return 0;
+    }
+
+    const auto slot = static_cast<std::uint8_t>(chunk->globals.size());
+    pool->globals.emplace(valueBits(string), slot);
+    chunk->globals.push_back(string);
+    return slot;
+}
+
+// Skips to the next declaration after an error, so that one mistake gives one
+// diagnostic.
+void Compiler::synchronize()
+{
+    parser.panicMode = false;
+    while (parser.current.type != TOKEN_EOF)
+    {
+        if (parser.previous.type == TOKEN_SEMICOLON || parser.current.type == TOKEN_VAR)
+        {
+            return;
+        }
+        advance();
+    }
+}
+
+// The source is not NUL-terminated, so strtod() must only see the token: what
+// follows it could extend the number, or make "0" the start of a hex literal.
 void Compiler::number()
 {
-    const double value = strtod(parser.previous.start, nullptr);
+    const std::string text(parser.previous.start, parser.previous.length);
+    const double value = strtod(text.c_str(), nullptr);
     emitConstant(NUMBER_VAL(value));
+    exprType = TYPE_NUMBER;
+}
+
+// Evaluates an operator on constant operands exactly as VM::run() would.
+// Returns false when the VM would raise a runtime error, so the error is
+// left to happen at runtime.
+static bool foldUnary(const TokenType operatorType, const Value& operand, Value* result)
+{
+    switch (operatorType)
+    {
+    case TOKEN_BANG:
+        *result = BOOL_VAL(isFalsey(operand));
+        return true;
+    case TOKEN_MINUS:
+        if (!IS_NUMBER(operand)) return false;
+        *result = NUMBER_VAL(-AS_NUMBER(operand));
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool foldBinary(const TokenType operatorType, const Value& a, const Value& b, Heap* heap, Value* result)
+{
+    switch (operatorType)
+    {
+    case TOKEN_BANG_EQUAL:  *result = BOOL_VAL(!valuesEqual(a, b)); return true;
+    case TOKEN_EQUAL_EQUAL: *result = BOOL_VAL(valuesEqual(a, b)); return true;
+    default: ;
+    }
+
+    if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b))
+    {
+        return heap != nullptr ? heap->concatenate(a, b, result) : concatenate(a, b, result);
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+    {
+        return false;
+    }
+
+    const double x = AS_NUMBER(a);
+    const double y = AS_NUMBER(b);
+    switch (operatorType)
+    {
+    // >= and <= run as a negated < and >, which differs from the direct test for NaN.
+    case TOKEN_GREATER:         *result = BOOL_VAL(x > y); return true;
+    case TOKEN_GREATER_EQUAL:   *result = BOOL_VAL(!(x < y)); return true;
+    case TOKEN_LESS:            *result = BOOL_VAL(x < y); return true;
+    case TOKEN_LESS_EQUAL:      *result = BOOL_VAL(!(x > y)); return true;
+    case TOKEN_PLUS:            *result = NUMBER_VAL(x + y); return true;
+    case TOKEN_MINUS:           *result = NUMBER_VAL(x - y); return true;
+    case TOKEN_STAR:            *result = NUMBER_VAL(x * y); return true;
+    case TOKEN_SLASH:           *result = NUMBER_VAL(x / y); return true;
+    default:                    return false;
+    }
 }
 
 void Compiler::unary()
 {
     const TokenType operatorType = parser.previous.type;
+    const std::size_t start = chunk->code.size();
 
     parsePrecedence(UNARY);
 
+    Value operand;
+    Value folded;
+    if (options.foldConstants &&
+        readConstantLoad(start, chunk->code.size(), &operand) && foldUnary(operatorType, operand, &folded))
+    {
+        discardConstantLoad(start);
+        emitFolded(folded);
+        return;
+    }
+
     switch (operatorType)
     {
-    case TOKEN_BANG: emitByte(OP_NOT); break;
-    case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+    case TOKEN_BANG: emitByte(OP_NOT); exprType = TYPE_BOOL; break;
+    case TOKEN_MINUS: emitArithmetic(OP_NEGATE, exprType == TYPE_NUMBER); exprType = TYPE_NUMBER; break;
     default: return;
     }
 }
@@ -127,20 +462,45 @@ void Compiler::binary()
 {
     const TokenType operatorType = parser.previous.type;
     const auto rule = getRule(operatorType);
+    const std::size_t leftStart = operandStart;
+    const std::size_t rightStart = chunk->code.size();
+    const StaticType leftType = exprType;
     parsePrecedence(static_cast<Precedence>(rule.precedence + 1)); // +1 because each binary operator's right hand operand is one level higher than its own. (Binary operator are left-associative)
 
+    Value a;
+    Value b;
+    Value folded;
+    if (options.foldConstants &&
+        readConstantLoad(leftStart, rightStart, &a) &&
+        readConstantLoad(rightStart, chunk->code.size(), &b) &&
+        foldBinary(operatorType, a, b, options.heap, &folded))
+    {
+        discardConstantLoad(rightStart);
+        discardConstantLoad(leftStart);
+        emitFolded(folded);
+        return;
+    }
+
+    const StaticType rightType = exprType;
+    const bool numbers = leftType == TYPE_NUMBER && rightType == TYPE_NUMBER;
+    exprType = TYPE_BOOL;
     switch(operatorType)
     {
     case TOKEN_BANG_EQUAL:      emitBytes(OP_EQUAL, OP_NOT); break;
     case TOKEN_EQUAL_EQUAL:     emitByte(OP_EQUAL); break;
-    case TOKEN_GREATER:         emitByte(OP_GREATER); break;
-    case TOKEN_GREATER_EQUAL:   emitBytes(OP_LESS, OP_NOT); break;
-    case TOKEN_LESS:            emitByte(OP_LESS); break;
-    case TOKEN_LESS_EQUAL:      emitBytes(OP_GREATER, OP_NOT); break;
-    case TOKEN_PLUS:            emitByte(OP_ADD); break;
-    case TOKEN_MINUS:           emitByte(OP_SUBTRACT); break;
-    case TOKEN_STAR:            emitByte(OP_MULTIPLY); break;
-    case TOKEN_SLASH:           emitByte(OP_DIVIDE); break;
+    case TOKEN_GREATER:         emitArithmetic(OP_GREATER, numbers); break;
+    case TOKEN_GREATER_EQUAL:   emitArithmetic(OP_LESS, numbers); emitByte(OP_NOT); break;
+    case TOKEN_LESS:            emitArithmetic(OP_LESS, numbers); break;
+    case TOKEN_LESS_EQUAL:      emitArithmetic(OP_GREATER, numbers); emitByte(OP_NOT); break;
+    case TOKEN_PLUS:
+        emitArithmetic(OP_ADD, numbers);
+        // One known operand tells which of the two additions runs, if any does.
+        exprType = leftType == TYPE_NUMBER || rightType == TYPE_NUMBER ? TYPE_NUMBER
+                 : leftType == TYPE_STRING || rightType == TYPE_STRING ? TYPE_STRING : TYPE_UNKNOWN;
+        break;
+    case TOKEN_MINUS:           emitArithmetic(OP_SUBTRACT, numbers); exprType = TYPE_NUMBER; break;
+    case TOKEN_STAR:            emitArithmetic(OP_MULTIPLY, numbers); exprType = TYPE_NUMBER; break;
+    case TOKEN_SLASH:           emitArithmetic(OP_DIVIDE, numbers); exprType = TYPE_NUMBER; break;
     default: return; // Unreachable
     }
 }
@@ -149,13 +509,58 @@ void Compiler::literal()
 {
     switch (parser.previous.type)
     {
-        case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NIL: emitByte(OP_NIL); break;
-        case TOKEN_TRUE: emitByte(OP_TRUE); break;
+        case TOKEN_FALSE: emitByte(OP_FALSE); exprType = TYPE_BOOL; break;
+        case TOKEN_NIL: emitByte(OP_NIL); exprType = TYPE_NIL; break;
+        case TOKEN_TRUE: emitByte(OP_TRUE); exprType = TYPE_BOOL; break;
         default: return; // Unreachable
     }
 }
 
+// Only the characters between the quotes, looked up in place: a literal seen
+// before costs no copy.
+void Compiler::string()
+{
+    emitConstant(internString(parser.previous.start + 1, parser.previous.length - 2));
+    exprType = TYPE_STRING;
+}
+
+// Inputs can be anything, and so can globals, which any chunk run by the VM
+// may assign: the operators they feed keep their checks.
+void Compiler::variable()
+{
+    const Token name = parser.previous;
+    const bool assignment = canAssign && match(TOKEN_EQUAL);
+    const auto found = std::find(options.inputs.begin(), options.inputs.end(),
+                                 std::string_view(name.start, name.length));
+    if (found == options.inputs.end())
+    {
+        const std::uint8_t slot = globalSlot(name);
+        if (assignment)
+        {
+            expression(); // Its value is that of the assignment, so exprType stays.
+            emitBytes(OP_SET_GLOBAL_SLOT, slot);
+            return;
+        }
+        emitBytes(OP_GET_GLOBAL_SLOT, slot);
+        exprType = TYPE_UNKNOWN;
+        return;
+    }
+
+    if (assignment)
+    {
+        error("Cannot assign to an input.");
+        return;
+    }
+    if (found - options.inputs.begin() > UCHAR_MAX)
+    {
+        error("Too many inputs in one chunk.");
+        return;
+    }
+
+    emitBytes(OP_INPUT, static_cast<std::uint8_t>(found - options.inputs.begin()));
+    exprType = TYPE_UNKNOWN;
+}
+
 void Compiler::grouping()
 {
     expression();
@@ -173,13 +578,22 @@ void Compiler::parsePrecedence(const Precedence precedence)
         return;
     }
 
+    const std::size_t start = chunk->code.size();
+    const bool assignable = precedence <= ASSIGNMENT;
+    canAssign = assignable;
     (this->*prefixRule)();
 
     while (precedence <= getRule(parser.current.type).precedence) {
         advance();
         const auto infixRule = getRule(parser.previous.type).infix;
+        operandStart = start;
         (this->*infixRule)();
     }
+
+    if (assignable && match(TOKEN_EQUAL))
+    {
+        error("Invalid assignment target.");
+    }
 }
 
 const ParseRule& Compiler::getRule(const TokenType type) {
@@ -204,8 +618,8 @@ const ParseRule& Compiler::getRule(const TokenType type) {
          {nullptr,                  &Compiler::binary,      Precedence::COMPARISON},    // GREATER_EQUAL
          {nullptr,                  &Compiler::binary,      Precedence::COMPARISON},    // LESS
          {nullptr,                  &Compiler::binary,      Precedence::COMPARISON},    // LESS_EQUAL
-         {nullptr,                  nullptr,                Precedence::NONE},          // IDENTIFIER
-         {nullptr,                  nullptr,                Precedence::NONE},          // STRING
+         {&Compiler::variable,      nullptr,                Precedence::NONE},          // IDENTIFIER
+         {&Compiler::string,        nullptr,                Precedence::NONE},          // STRING
          {&Compiler::number,        nullptr,                Precedence::NONE},          // NUMBER
          {nullptr,                  nullptr,                Precedence::NONE},          // AND
          {nullptr,                  nullptr,                Precedence::NONE},          // CLASS
@@ -248,11 +662,11 @@ void Compiler::errorAt(const Token& token, const std::string& message)
     }
 
     parser.panicMode = true;
-    fprintf(stderr, "[line %d] Error", token.line);
+    std::string text = "[line " + std::to_string(token.line) + "] Error";
 
     if (token.type == TOKEN_EOF)
     {
-        fprintf(stderr, " at end");
+        text += " at end";
     }
     else if (token.type == TOKEN_ERROR)
     {
@@ -260,9 +674,17 @@ void Compiler::errorAt(const Token& token, const std::string& message)
     }
     else
     {
-        fprintf(stderr, " at '%.*s'", token.length, token.start);
+        text += " at '" + std::string(token.start, token.length) + "'";
     }
 
-    fprintf(stderr, ": %s\n", message.c_str());
+    text += ": " + message + "\n";
+    if (errors != nullptr)
+    {
+        errors->append(text);
+    }
+    else
+    {
+        fputs(text.c_str(), stderr);
+    }
     parser.hadError = true;
 }
\ No newline at end of file
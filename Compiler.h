@@ -1,6 +1,12 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "Source.h"
 #include "Chunk.h"
@@ -8,6 +14,7 @@
 #include "Value.h"
 
 class Compiler;
+class Heap;
 
 struct Parser
 {
@@ -38,34 +45,101 @@ struct ParseRule {
     Precedence precedence;
 };
 
+struct CompilerOptions
+{
+    bool foldConstants = true;
+    bool peephole = true;
+    bool inferTypes = true;     // Emits unchecked arithmetic for operands known to be numbers.
+    bool dumpBytecode = false;  // Disassembles the finished chunk to stdout.
+    // Names an identifier may refer to. Each compiles to an OP_INPUT of its
+    // index here, whose value is bound when the chunk runs. Inputs cannot be
+    // assigned, and other identifiers name global variables.
+    std::vector<std::string> inputs;
+    // Owner of the long string literals, folded strings and global names of
+    // the chunk, which are then collected like the strings its VM builds: the
+    // host keeps them in the extra roots of that VM while it may run the
+    // chunk, as EvalServer does. Null interns them process-wide, for good.
+    Heap* heap = nullptr;
+};
+
+// What the compiler knows about the value of a subexpression.
+enum StaticType: std::uint8_t
+{
+    TYPE_UNKNOWN,
+    TYPE_NUMBER,
+    TYPE_BOOL,
+    TYPE_NIL,
+    TYPE_STRING,
+};
+
+// Pool entries of the chunk being compiled, interned on their bits so that
+// repeated literals share one entry.
+struct ConstantPool
+{
+    std::pmr::unordered_map<std::uint64_t, std::uint32_t> slots;  // valueBits() -> pool index.
+    std::pmr::vector<std::uint32_t> loads;                          // Emitted loads of each entry.
+    std::pmr::unordered_map<std::uint64_t, std::uint8_t> globals;   // valueBits() of a name -> global slot.
+
+    explicit ConstantPool(std::pmr::memory_resource* resource)
+        : slots(resource), loads(resource), globals(resource) {}
+};
+
 class Compiler
 {
 public:
     Compiler() = default;
+    explicit Compiler(const CompilerOptions& options) : options(options) {}
 
     bool compile(const Source& source, Chunk* chunk);
 
+    // Appends diagnostics to buffer instead of printing them to stderr.
+    void setErrorOutput(std::string* buffer) { errors = buffer; }
+
+    // Arena bytes to reserve before compiling sourceSize bytes into an arena chunk.
+    static std::size_t arenaBytes(std::size_t sourceSize);
+
     void grouping();
     void number();
     void unary();
     void binary();
     void literal();
+    void string();
+    void variable();
 
 private:
+    CompilerOptions options;
+    std::string* errors = nullptr;
     Scanner scanner{};
     Parser parser;
     Chunk* chunk = nullptr;
+    std::optional<ConstantPool> pool; // Allocated with the chunk.
+    std::size_t operandStart = 0; // Code offset of the left operand of the infix rule being parsed.
+    StaticType exprType = TYPE_UNKNOWN; // Of the subexpression compiled last.
+    bool canAssign = false; // Whether the prefix rule being parsed may be the target of an =.
 
     void advance();
     void consume(TokenType type, const std::string& message);
+    bool match(TokenType type);
     void emitByte(std::uint8_t byte) const;
     void emitBytes(std::uint8_t byte1, std::uint8_t byte2) const;
     void emitReturn() const;
     void emitConstant(Value value);
-    std::uint8_t makeConstant(Value value);
+    Value internString(const char* chars, std::size_t length) const;
+    std::uint32_t makeConstant(Value value);
+    std::uint32_t loadedConstant(std::size_t start) const;
     void endCompiler() const;
+    void reserveChunk(std::size_t sourceSize) const;
+
+    bool readConstantLoad(std::size_t start, std::size_t end, Value* value) const;
+    void discardConstantLoad(std::size_t start);
+    void emitFolded(Value value);
+    void emitArithmetic(std::uint8_t instruction, bool numberOperands);
 
     void expression();
+    bool declaration();
+    void varDeclaration();
+    std::uint8_t globalSlot(const Token& name);
+    void synchronize();
 
     void parsePrecedence(Precedence precedence);
     static const ParseRule& getRule(TokenType type);
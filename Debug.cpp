@@ -6,73 +6,138 @@
 #include "Chunk.h"
 #include "Value.h"
 
+const char* opcodeName(const std::uint8_t instruction)
+{
+    switch (instruction) {
+    case OpCode::OP_CONSTANT:                 return "OP_CONSTANT";
+    case OpCode::OP_CONSTANT_LONG:            return "OP_CONSTANT_LONG";
+    case OpCode::OP_NIL:                      return "OP_NIL";
+    case OpCode::OP_TRUE:                     return "OP_TRUE";
+    case OpCode::OP_FALSE:                    return "OP_FALSE";
+    case OpCode::OP_INPUT:                    return "OP_INPUT";
+    case OpCode::OP_POP:                      return "OP_POP";
+    case OpCode::OP_DEFINE_GLOBAL_SLOT:       return "OP_DEFINE_GLOBAL_SLOT";
+    case OpCode::OP_GET_GLOBAL_SLOT:          return "OP_GET_GLOBAL_SLOT";
+    case OpCode::OP_SET_GLOBAL_SLOT:          return "OP_SET_GLOBAL_SLOT";
+    case OpCode::OP_EQUAL:                    return "OP_EQUAL";
+    case OpCode::OP_NOT_EQUAL:                return "OP_NOT_EQUAL";
+    case OpCode::OP_GREATER:                  return "OP_GREATER";
+    case OpCode::OP_GREATER_EQUAL:            return "OP_GREATER_EQUAL";
+    case OpCode::OP_LESS:                     return "OP_LESS";
+    case OpCode::OP_LESS_EQUAL:               return "OP_LESS_EQUAL";
+    case OpCode::OP_ADD:                      return "OP_ADD";
+    case OpCode::OP_SUBTRACT:                 return "OP_SUBTRACT";
+    case OpCode::OP_MULTIPLY:                 return "OP_MULTIPLY";
+    case OpCode::OP_DIVIDE:                   return "OP_DIVIDE";
+    case OpCode::OP_NOT:                      return "OP_NOT";
+    case OpCode::OP_NEGATE:                   return "OP_NEGATE";
+    case OpCode::OP_RETURN:                   return "OP_RETURN";
+    case OpCode::OP_GREATER_UNCHECKED:        return "OP_GREATER_UNCHECKED";
+    case OpCode::OP_GREATER_EQUAL_UNCHECKED:  return "OP_GREATER_EQUAL_UNCHECKED";
+    case OpCode::OP_LESS_UNCHECKED:           return "OP_LESS_UNCHECKED";
+    case OpCode::OP_LESS_EQUAL_UNCHECKED:     return "OP_LESS_EQUAL_UNCHECKED";
+    case OpCode::OP_ADD_UNCHECKED:            return "OP_ADD_UNCHECKED";
+    case OpCode::OP_SUBTRACT_UNCHECKED:       return "OP_SUBTRACT_UNCHECKED";
+    case OpCode::OP_MULTIPLY_UNCHECKED:       return "OP_MULTIPLY_UNCHECKED";
+    case OpCode::OP_DIVIDE_UNCHECKED:         return "OP_DIVIDE_UNCHECKED";
+    case OpCode::OP_NEGATE_UNCHECKED:         return "OP_NEGATE_UNCHECKED";
+    case OpCode::OP_GREATER_NUM:              return "OP_GREATER_NUM";
+    case OpCode::OP_GREATER_EQUAL_NUM:        return "OP_GREATER_EQUAL_NUM";
+    case OpCode::OP_LESS_NUM:                 return "OP_LESS_NUM";
+    case OpCode::OP_LESS_EQUAL_NUM:           return "OP_LESS_EQUAL_NUM";
+    case OpCode::OP_ADD_NUM:                  return "OP_ADD_NUM";
+    case OpCode::OP_SUBTRACT_NUM:             return "OP_SUBTRACT_NUM";
+    case OpCode::OP_MULTIPLY_NUM:             return "OP_MULTIPLY_NUM";
+    case OpCode::OP_DIVIDE_NUM:               return "OP_DIVIDE_NUM";
+    case OpCode::OP_NEGATE_NUM:               return "OP_NEGATE_NUM";
+    default:                                  return nullptr;
+    }
+}
+
 int simpleInstruction(const std::string& name, const int offset)
 {
     printf("%s\n", name.c_str());
     return offset + 1;
 }
 
-int constantInstruction(const std::string& name, const Chunk& chunk, const int offset)
+int constantInstruction(const std::string& name, const ChunkView& chunk, const int offset)
 {
     const std::uint8_t constant = chunk.code[offset + 1];
 
     printf("%-16s %4d '", name.c_str(), constant);
-    printValue(chunk.constants.values[constant]);
+    printValue(chunk.constants[constant]);
     printf("'\n");
 
     return offset + 2;
 }
 
-int disassembleInstruction(const Chunk& chunk, const int offset)
+int byteInstruction(const std::string& name, const ChunkView& chunk, const int offset)
+{
+    printf("%-16s %4d\n", name.c_str(), chunk.code[offset + 1]);
+    return offset + 2;
+}
+
+int globalInstruction(const std::string& name, const ChunkView& chunk, const int offset)
+{
+    const std::uint8_t slot = chunk.code[offset + 1];
+
+    printf("%-16s %4d '", name.c_str(), slot);
+    printValue(chunk.globals[slot]);
+    printf("'\n");
+
+    return offset + 2;
+}
+
+int constantLongInstruction(const std::string& name, const ChunkView& chunk, const int offset)
+{
+    const std::uint32_t constant = readLongOperand(&chunk.code[offset + 1]);
+
+    printf("%-16s %4u '", name.c_str(), constant);
+    printValue(chunk.constants[constant]);
+    printf("'\n");
+
+    return offset + 4;
+}
+
+int disassembleInstruction(const ChunkView& chunk, const int offset)
 {
     printf("%04d ", offset);
 
-    if (offset > 0 && chunk.lines[offset] == chunk.lines[offset - 1])
+    const int line = chunk.getLine(offset);
+    if (offset > 0 && line == chunk.getLine(offset - 1))
     {
         printf("   | ");
     }
     else
     {
-        printf("%4d ", chunk.lines[offset]);
+        printf("%4d ", line);
     }
 
     const std::uint8_t instruction = chunk.code[offset];
+    const char* name = opcodeName(instruction);
+    if (name == nullptr)
+    {
+        printf("Unknown opcode %d\n", instruction);
+        return offset + 1;
+    }
+
     switch (instruction) {
     case OpCode::OP_CONSTANT:
-        return constantInstruction("OP_CONSTANT", chunk, offset);
-    case OpCode::OP_NIL:
-        return simpleInstruction("OP_NIL", offset);
-    case OpCode::OP_TRUE:
-        return simpleInstruction("OP_TRUE", offset);
-    case OpCode::OP_FALSE:
-        return simpleInstruction("OP_FALSE", offset);
-    case OpCode::OP_EQUAL:
-        return simpleInstruction("OP_EQUAL", offset);
-    case OpCode::OP_GREATER:
-        return simpleInstruction("OP_GREATER", offset);
-    case OpCode::OP_LESS:
-        return simpleInstruction("OP_LESS", offset);
-    case OpCode::OP_ADD:
-        return simpleInstruction("OP_ADD", offset);
-    case OpCode::OP_SUBTRACT:
-        return simpleInstruction("OP_SUBTRACT", offset);
-    case OpCode::OP_MULTIPLY:
-        return simpleInstruction("OP_MULTIPLY", offset);
-    case OpCode::OP_DIVIDE:
-        return simpleInstruction("OP_DIVIDE", offset);
-    case OpCode::OP_NOT:
-        return simpleInstruction("OP_NOT", offset);
-    case OpCode::OP_NEGATE:
-        return simpleInstruction("OP_NEGATE", offset);
-    case OpCode::OP_RETURN:
-        return simpleInstruction("OP_RETURN", offset);
+        return constantInstruction(name, chunk, offset);
+    case OpCode::OP_CONSTANT_LONG:
+        return constantLongInstruction(name, chunk, offset);
+    case OpCode::OP_INPUT:
+        return byteInstruction(name, chunk, offset);
+    case OpCode::OP_DEFINE_GLOBAL_SLOT:
+    case OpCode::OP_GET_GLOBAL_SLOT:
+    case OpCode::OP_SET_GLOBAL_SLOT:
+        return globalInstruction(name, chunk, offset);
     default:
-        printf("Unknown opcode %d\n", instruction);
-        return offset + 1;
+        return simpleInstruction(name, offset);
     }
 }
 
-void disassembleChunk(const Chunk& chunk, const std::string& name)
+void disassembleChunk(const ChunkView& chunk, const std::string& name)
 {
     printf("== %s ==\n", name.c_str());
 
@@ -81,3 +146,29 @@ void disassembleChunk(const Chunk& chunk, const std::string& name)
         offset = disassembleInstruction(chunk, offset);
     }
 }
+
+OperandChecks countOperandChecks(const ChunkView& chunk)
+{
+    OperandChecks checks;
+    for (std::size_t offset = 0; offset < chunk.code.size(); offset += instructionLength(chunk.code[offset]))
+    {
+        const std::uint8_t instruction = chunk.code[offset];
+        if (checkedOpcode(instruction) != instruction)
+        {
+            checks.elided++;
+        }
+        else if (uncheckedOpcode(instruction) != instruction)
+        {
+            checks.checked++;
+        }
+    }
+    return checks;
+}
+
+void printOperandChecks(const ChunkView& chunk)
+{
+    const OperandChecks checks = countOperandChecks(chunk);
+    const int total = checks.checked + checks.elided;
+    printf("== operand checks: %d of %d elided (%.1f%%) ==\n", checks.elided, total,
+           total > 0 ? 100.0 * checks.elided / total : 0.0);
+}
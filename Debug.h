@@ -1,6 +1,22 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+
 #include "Chunk.h"
 
-int disassembleInstruction(const Chunk& chunk, int offset);
-void disassembleChunk(const Chunk& chunk, const std::string& name);
+// Null for bytes that are not opcodes.
+const char* opcodeName(std::uint8_t instruction);
+int disassembleInstruction(const ChunkView& chunk, int offset);
+void disassembleChunk(const ChunkView& chunk, const std::string& name);
+
+// Instructions that check their operand types at runtime, and those the compiler
+// emitted unchecked because it proved the operands are numbers.
+struct OperandChecks
+{
+    int checked = 0;
+    int elided = 0;
+};
+
+OperandChecks countOperandChecks(const ChunkView& chunk);
+void printOperandChecks(const ChunkView& chunk);
@@ -0,0 +1,290 @@
+#include "Heap.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+void PauseHistogram::record(const std::uint64_t ns)
+{
+    // Below SUB_BUCKETS a bucket per nanosecond, then SUB_BUCKETS per power of two.
+    std::size_t index = ns;
+    if (ns >= SUB_BUCKETS)
+    {
+        const int exponent = static_cast<int>(std::bit_width(ns)) - 1;
+        index = static_cast<std::size_t>(exponent - 1) * SUB_BUCKETS + (ns >> (exponent - 2) & (SUB_BUCKETS - 1));
+    }
+    buckets[std::min(index, BUCKETS - 1)]++;
+    pauses++;
+    total += ns;
+    longest = std::max(longest, ns);
+}
+
+void PauseHistogram::add(const PauseHistogram& other)
+{
+    for (std::size_t i = 0; i < BUCKETS; i++)
+    {
+        buckets[i] += other.buckets[i];
+    }
+    pauses += other.pauses;
+    total += other.total;
+    longest = std::max(longest, other.longest);
+}
+
+std::uint64_t PauseHistogram::bucketLimitNs(const std::size_t i)
+{
+    if (i < SUB_BUCKETS)
+    {
+        return i + 1;
+    }
+    const std::size_t exponent = i / SUB_BUCKETS + 1;
+    return (SUB_BUCKETS + 1 + i % SUB_BUCKETS) << (exponent - 2);
+}
+
+std::uint64_t PauseHistogram::percentileNs(const double p) const
+{
+    if (pauses == 0)
+    {
+        return 0;
+    }
+
+    const auto rank = std::clamp<std::uint64_t>(
+        static_cast<std::uint64_t>(std::ceil(p * static_cast<double>(pauses))), 1, pauses);
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            return std::min(bucketLimitNs(i), longest);
+        }
+    }
+    return longest;
+}
+
+Heap::~Heap()
+{
+    for (ObjString* list : {objects, unswept})
+    {
+        while (list != nullptr)
+        {
+            ObjString* next = list->next;
+            if (--list->buffer->strings == 0)
+            {
+                delete list->buffer;
+            }
+            delete list;
+            list = next;
+        }
+    }
+}
+
+void Heap::setOptions(const GcOptions& o)
+{
+    options = o;
+    pace();
+}
+
+bool Heap::concatenate(const Value& a, const Value& b, Value* result)
+{
+    char scratchA[SHORT_STRING_MAX];
+    char scratchB[SHORT_STRING_MAX];
+    const std::string_view head = stringChars(a, scratchA);
+    const std::string_view tail = stringChars(b, scratchB);
+    const std::size_t length = head.size() + tail.size();
+    if (length <= SHORT_STRING_MAX || length > MAX_STRING_LENGTH)
+    {
+        return ::concatenate(a, b, result); // Short or too long: no table is involved.
+    }
+
+    const std::uint32_t headHash = IS_OBJ_STRING(a) ? AS_OBJ_STRING(a)->hash : hashString(head.data(), head.size());
+    const std::uint32_t hash = hashString(tail.data(), tail.size(), headHash);
+
+    if (ObjString* interned = find(hash, head, tail))
+    {
+        *result = OBJ_STRING_VAL(interned);
+        return true;
+    }
+
+    ObjString* string;
+    StringBuffer* buffer = IS_OBJ_STRING(a) ? AS_OBJ_STRING(a)->buffer : nullptr;
+    if (buffer != nullptr && buffer->owner == this && head.data() + head.size() == buffer->chars.get() + buffer->used &&
+        buffer->capacity - buffer->used >= tail.size())
+    {
+        std::memcpy(buffer->chars.get() + buffer->used, tail.data(), tail.size());
+        buffer->used += tail.size();
+        string = allocate(head.data(), length, hash, buffer);
+    }
+    else
+    {
+        // Room to double, so that a chain appends in place from here on.
+        buffer = allocateBuffer(std::min(length * 2, MAX_STRING_LENGTH));
+        std::memcpy(buffer->chars.get(), head.data(), head.size());
+        std::memcpy(buffer->chars.get() + head.size(), tail.data(), tail.size());
+        buffer->used = length;
+        string = allocate(buffer->chars.get(), length, hash, buffer);
+    }
+
+    strings.insert(string);
+    *result = OBJ_STRING_VAL(string);
+    return true;
+}
+
+Value Heap::makeString(const char* chars, const std::size_t length)
+{
+    if (length <= SHORT_STRING_MAX)
+    {
+        return ::makeString(chars, length);
+    }
+
+    const std::uint32_t hash = hashString(chars, length);
+    if (ObjString* interned = find(hash, {chars, length}, {}))
+    {
+        return OBJ_STRING_VAL(interned);
+    }
+
+    // Sized exactly, like the literals of the process-wide table.
+    StringBuffer* buffer = allocateBuffer(length);
+    std::memcpy(buffer->chars.get(), chars, length);
+    buffer->used = length;
+    ObjString* string = allocate(buffer->chars.get(), length, hash, buffer);
+    strings.insert(string);
+    return OBJ_STRING_VAL(string);
+}
+
+// Reusing a string of the process-wide table, such as a literal, keeps equal
+// strings one object, which compares by address.
+ObjString* Heap::find(const std::uint32_t hash, const std::string_view head, const std::string_view tail)
+{
+    if (ObjString* interned = findString(hash, head, tail))
+    {
+        return interned;
+    }
+
+    ObjString* interned = strings.find(hash, head, tail);
+    // Found while sweeping, it may be garbage the sweep has yet to free: it is
+    // reachable again. One swept already survives the next cycle as well.
+    if (interned != nullptr && phase == GC_SWEEP)
+    {
+        interned->color = GC_BLACK;
+    }
+    return interned;
+}
+
+void Heap::beginMark()
+{
+    phase = GC_MARK;
+}
+
+void Heap::beginSweep()
+{
+    unswept = objects;
+    objects = nullptr;
+    phase = GC_SWEEP;
+}
+
+bool Heap::sweep(std::size_t* work)
+{
+    for (; unswept != nullptr && *work > 0; (*work)--)
+    {
+        ObjString* string = unswept;
+        unswept = string->next;
+        if (string->color == GC_WHITE)
+        {
+            free(string);
+        }
+        else
+        {
+            string->color = GC_WHITE;
+            string->next = objects;
+            objects = string;
+        }
+    }
+    if (unswept != nullptr)
+    {
+        return false;
+    }
+
+    phase = GC_IDLE;
+    swept = true;
+    return true;
+}
+
+void Heap::endStep(const std::uint64_t pauseNs)
+{
+    stats.current.steps++;
+    stats.current.pauses.record(pauseNs);
+    stats.pauses.record(pauseNs);
+
+    if (swept)
+    {
+        swept = false;
+        stats.cycles++;
+        stats.current.liveBytes = stats.heapBytes;
+        stats.last = stats.current;
+        stats.current = GcCycle{};
+    }
+    pace();
+}
+
+// A running cycle steps every stepBytes. An idle heap starts the next cycle
+// once it grows to heapGrowth times what the last one left alive.
+void Heap::pace()
+{
+    if (phase != GC_IDLE)
+    {
+        untilStep = options.stepBytes;
+        return;
+    }
+
+    const auto target = static_cast<std::size_t>(static_cast<double>(stats.last.liveBytes) * options.heapGrowth);
+    const std::size_t threshold = std::max(options.minimumHeap, target);
+    untilStep = threshold > stats.heapBytes ? threshold - stats.heapBytes : 0;
+}
+
+// Black while marking: the slots that will hold it may be scanned already.
+ObjString* Heap::allocate(const char* chars, const std::size_t length, const std::uint32_t hash,
+                          StringBuffer* buffer)
+{
+    buffer->strings++;
+    auto* string = new ObjString{chars, static_cast<std::uint32_t>(length), hash, buffer, objects,
+                                 phase == GC_MARK ? GC_BLACK : GC_WHITE};
+    objects = string;
+    counted(sizeof(ObjString));
+    return string;
+}
+
+StringBuffer* Heap::allocateBuffer(const std::size_t capacity)
+{
+    auto* buffer = new StringBuffer{std::make_unique<char[]>(capacity), capacity, 0, this};
+    counted(sizeof(StringBuffer) + capacity);
+    return buffer;
+}
+
+void Heap::free(ObjString* string)
+{
+    strings.remove(string);
+
+    std::size_t bytes = sizeof(ObjString);
+    StringBuffer* buffer = string->buffer;
+    if (--buffer->strings == 0)
+    {
+        bytes += sizeof(StringBuffer) + buffer->capacity;
+        delete buffer;
+    }
+    delete string;
+
+    stats.heapBytes -= bytes;
+    stats.bytesFreed += bytes;
+    stats.current.bytesFreed += bytes;
+}
+
+void Heap::counted(const std::size_t bytes)
+{
+    stats.heapBytes += bytes;
+    stats.bytesAllocated += bytes;
+    stats.current.bytesAllocated += bytes;
+    untilStep = untilStep > bytes ? untilStep - bytes : 0;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "Object.h"
+#include "StringTable.h"
+#include "Value.h"
+
+// When the collector runs and how much it does at a time. Every figure counts
+// bytes allocated, never time, so a run allocating nothing never collects.
+struct GcOptions
+{
+    std::size_t minimumHeap = 1 << 20;  // Heap bytes below which no cycle starts.
+    double heapGrowth = 2.0;            // Pacing target: a cycle starts once the heap reaches this many times
+                                        // the bytes live after the previous one.
+    std::size_t stepBytes = 32 * 1024;  // Allocation between two steps of a running cycle.
+    std::size_t stepWork = 2048;        // Slots and strings one step visits, which bounds its pause. Cycles
+                                        // keep up as long as it exceeds stepBytes / sizeof(ObjString).
+};
+
+// Pause times in buckets of a quarter of a power of two nanoseconds.
+class PauseHistogram
+{
+public:
+    static constexpr std::size_t SUB_BUCKETS = 4;
+    static constexpr std::size_t BUCKETS = 40 * SUB_BUCKETS; // Up to about 18 minutes.
+
+    void record(std::uint64_t ns);
+    void add(const PauseHistogram& other);
+
+    std::uint64_t count() const { return pauses; }
+    std::uint64_t totalNs() const { return total; }
+    std::uint64_t maxNs() const { return longest; }
+
+    // Upper bound of the bucket of the pause at fraction p, from 0 to 1, of
+    // the sorted pauses. Zero without pauses.
+    std::uint64_t percentileNs(double p) const;
+
+    // Pauses in bucket i, which ends at bucketLimitNs(i).
+    std::uint64_t bucket(std::size_t i) const { return buckets[i]; }
+    static std::uint64_t bucketLimitNs(std::size_t i);
+
+private:
+    std::array<std::uint64_t, BUCKETS> buckets{};
+    std::uint64_t pauses = 0;
+    std::uint64_t total = 0;
+    std::uint64_t longest = 0;
+};
+
+// Telemetry of one cycle, which spans the allocation from the end of the
+// previous cycle to the end of its own sweep.
+struct GcCycle
+{
+    std::size_t bytesAllocated = 0;
+    std::size_t bytesFreed = 0;
+    std::size_t liveBytes = 0;          // Heap bytes once swept.
+    std::size_t steps = 0;
+    PauseHistogram pauses;
+};
+
+struct GcStats
+{
+    std::size_t cycles = 0;             // Completed ones.
+    std::size_t heapBytes = 0;          // Strings and their buffers.
+    std::size_t bytesAllocated = 0;     // Since the heap was created.
+    std::size_t bytesFreed = 0;
+    GcCycle current;                    // The cycle so far.
+    GcCycle last;                       // The last completed one.
+    PauseHistogram pauses;              // Of every step so far.
+};
+
+enum GcPhase: std::uint8_t
+{
+    GC_IDLE,
+    GC_MARK,
+    GC_SWEEP,
+};
+
+// Strings a VM builds while running, collected by an incremental tri-color
+// mark-sweep. The VM drives a cycle: it shades its roots, scans the gray ones,
+// its global slots and the host's extra roots, a few at a time between
+// instructions, then sweeps a few strings at a time. Stores into scanned slots
+// go through writeBarrier(), which shades the stored string so that no black
+// slot refers to a white string. Strings allocated while marking are black, so
+// a cycle frees only what was garbage when it started.
+class Heap
+{
+public:
+    Heap() = default;
+    ~Heap();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    void setOptions(const GcOptions& options);
+    const GcOptions& getOptions() const { return options; }
+    const GcStats& getStats() const { return stats; }
+    GcPhase getPhase() const { return phase; }
+
+    // The string a + b, owned by this heap unless short or already interned
+    // process-wide. Appends in place when a is the longest string built in a
+    // buffer of this heap. Fails when the result would be longer than
+    // MAX_STRING_LENGTH.
+    bool concatenate(const Value& a, const Value& b, Value* result);
+
+    // The string of length chars, owned by this heap unless short or already
+    // interned process-wide: for the compiler, see CompilerOptions::heap.
+    Value makeString(const char* chars, std::size_t length);
+
+    // The allocation counter ran out: the VM should call its collector, which
+    // starts a cycle when idle.
+    bool isStepDue() const { return untilStep == 0; }
+
+    // Strings of other heaps and of the process-wide table are left alone.
+    void shade(const Value& value)
+    {
+        if (IS_OBJ_STRING(value))
+        {
+            ObjString* string = AS_OBJ_STRING(value);
+            if (string->buffer->owner == this && string->color == GC_WHITE)
+            {
+                string->color = GC_BLACK;
+            }
+        }
+    }
+
+    // For every store of a value into a slot the collector may have scanned.
+    void writeBarrier(const Value& value)
+    {
+        if (phase == GC_MARK)
+        {
+            shade(value);
+        }
+    }
+
+    // Phases of a cycle, in order. sweep() does up to *work units and takes
+    // them off; it returns true once every string is swept and the cycle over.
+    void beginMark();
+    void beginSweep();
+    bool sweep(std::size_t* work);
+
+    // Pause of one call into the collector, then paces the next one.
+    void endStep(std::uint64_t pauseNs);
+
+private:
+    GcOptions options;
+    GcStats stats;
+    GcPhase phase = GC_IDLE;
+    StringTable strings;
+    ObjString* objects = nullptr;       // Every string, but those left to sweep.
+    ObjString* unswept = nullptr;       // Strings of the cycle being swept.
+    bool swept = false;                 // The cycle ended in the current step.
+    std::size_t untilStep = GcOptions{}.minimumHeap; // Bytes left to allocate before the next step.
+
+    ObjString* find(std::uint32_t hash, std::string_view head, std::string_view tail);
+    ObjString* allocate(const char* chars, std::size_t length, std::uint32_t hash, StringBuffer* buffer);
+    StringBuffer* allocateBuffer(std::size_t capacity);
+    void free(ObjString* string);
+    void counted(std::size_t bytes);
+    void pace();
+};
@@ -0,0 +1,442 @@
+#include "Jit.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "Chunk.h"
+#include "Common.h"
+#include "Value.h"
+#include "VM.h"
+
+#ifdef CLOXX_HAS_JIT
+#include <sys/mman.h>
+#endif
+
+#ifdef CLOXX_HAS_JIT
+
+// Registers by their x86-64 encoding.
+enum Register: std::uint8_t
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RDI = 7,
+};
+
+enum XmmRegister: std::uint8_t
+{
+    XMM0 = 0,
+    XMM1 = 1,
+};
+
+// Condition codes of Jcc and SETcc.
+enum Condition: std::uint8_t
+{
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+};
+
+// Just the instructions the JIT needs. Memory operands are always the VM stack,
+// addressed as [rbx + disp32].
+class Assembler
+{
+public:
+    std::vector<std::uint8_t> code;
+
+    std::size_t position() const { return code.size(); }
+
+    void bytes(const std::initializer_list<std::uint8_t> values)
+    {
+        code.insert(code.end(), values);
+    }
+
+    void imm32(const std::uint32_t value)
+    {
+        for (int i = 0; i < 4; i++) code.push_back(static_cast<std::uint8_t>(value >> 8 * i));
+    }
+
+    void imm64(const std::uint64_t value)
+    {
+        for (int i = 0; i < 8; i++) code.push_back(static_cast<std::uint8_t>(value >> 8 * i));
+    }
+
+    // ModRM and displacement of [rbx + disp].
+    void stackOperand(const std::uint8_t reg, const std::int32_t disp)
+    {
+        code.push_back(static_cast<std::uint8_t>(0x80 | reg << 3 | RBX));
+        imm32(static_cast<std::uint32_t>(disp));
+    }
+
+    void load(const Register reg, const std::int32_t disp)        { bytes({0x48, 0x8B}); stackOperand(reg, disp); }
+    void store(const std::int32_t disp, const Register reg)       { bytes({0x48, 0x89}); stackOperand(reg, disp); }
+    void storeByte(const std::int32_t disp, const std::uint8_t v) { bytes({0xC6}); stackOperand(0, disp); code.push_back(v); }
+    void storeAl(const std::int32_t disp)                         { bytes({0x88}); stackOperand(RAX, disp); }
+    void cmpByte(const std::int32_t disp, const std::uint8_t v)   { bytes({0x80}); stackOperand(7, disp); code.push_back(v); }
+    void xorByte(const std::int32_t disp, const std::uint8_t v)   { bytes({0x80}); stackOperand(6, disp); code.push_back(v); }
+    void leaRdi(const std::int32_t disp)                          { bytes({0x48, 0x8D}); stackOperand(RDI, disp); }
+
+    void movImm(const Register reg, const std::uint64_t value)
+    {
+        bytes({0x48, static_cast<std::uint8_t>(0xB8 + reg)});
+        imm64(value);
+    }
+
+    void movsdLoad(const XmmRegister xmm, const std::int32_t disp)  { bytes({0xF2, 0x0F, 0x10}); stackOperand(xmm, disp); }
+    void movsdStore(const std::int32_t disp, const XmmRegister xmm) { bytes({0xF2, 0x0F, 0x11}); stackOperand(xmm, disp); }
+
+    // addsd, subsd, mulsd or divsd xmm0, xmm1.
+    void arithmetic(const std::uint8_t opcode) { bytes({0xF2, 0x0F, opcode, 0xC1}); }
+
+    void ucomisd(const XmmRegister a, const XmmRegister b)
+    {
+        bytes({0x66, 0x0F, 0x2E, static_cast<std::uint8_t>(0xC0 | a << 3 | b)});
+    }
+
+    void setcc(const Condition condition) { bytes({0x0F, static_cast<std::uint8_t>(0x90 | condition), 0xC0}); }
+
+    // Returns the position of the rel32 to patch.
+    std::size_t jcc(const Condition condition)
+    {
+        bytes({0x0F, static_cast<std::uint8_t>(0x80 | condition)});
+        imm32(0);
+        return position() - 4;
+    }
+
+    std::size_t jmp()
+    {
+        bytes({0xE9});
+        imm32(0);
+        return position() - 4;
+    }
+
+    void patch(const std::size_t at, const std::size_t target)
+    {
+        const auto rel = static_cast<std::uint32_t>(static_cast<std::int64_t>(target) - static_cast<std::int64_t>(at + 4));
+        for (int i = 0; i < 4; i++) code[at + i] = static_cast<std::uint8_t>(rel >> 8 * i);
+    }
+
+    void call(const void* function)
+    {
+        movImm(RAX, reinterpret_cast<std::uint64_t>(function));
+        bytes({0xFF, 0xD0});
+    }
+};
+
+// Called by the generated code for what is not worth inlining.
+static void jitEqual(Value* operands)
+{
+    operands[0] = BOOL_VAL(valuesEqual(operands[0], operands[1]));
+}
+
+static void jitNotEqual(Value* operands)
+{
+    operands[0] = BOOL_VAL(!valuesEqual(operands[0], operands[1]));
+}
+
+static void jitNot(Value* operand)
+{
+    *operand = BOOL_VAL(isFalsey(*operand));
+}
+
+#ifdef CLOXX_NAN_BOXING
+constexpr std::int32_t NUMBER_OFFSET = 0;
+#else
+constexpr std::int32_t NUMBER_OFFSET = offsetof(Value, as);
+#endif
+
+static std::int32_t slotOffset(const std::uint32_t slot)
+{
+    return static_cast<std::int32_t>(slot * sizeof(Value));
+}
+
+class JitCompiler
+{
+public:
+    Assembler assembler;
+    std::vector<JitExit> exits;
+
+    bool compile(const ChunkView& chunk);
+
+private:
+    struct Guard
+    {
+        std::size_t patchAt;
+        std::uint32_t exit;
+    };
+    std::vector<Guard> guards;
+
+    std::uint32_t addExit(std::uint32_t offset, std::uint32_t depth, bool returned);
+    void storeValue(std::uint32_t slot, const Value& value);
+    void guardNumber(std::uint32_t slot, std::uint32_t exit);
+    void storeBool(std::uint32_t slot, Condition condition);
+    void binary(std::uint8_t instruction, std::uint32_t a, bool checked, std::uint32_t exit);
+};
+
+std::uint32_t JitCompiler::addExit(const std::uint32_t offset, const std::uint32_t depth, const bool returned)
+{
+    exits.push_back(JitExit{offset, depth, returned});
+    return static_cast<std::uint32_t>(exits.size() - 1);
+}
+
+// Writes the bytes of a value word by word, so constants cost no memory load.
+void JitCompiler::storeValue(const std::uint32_t slot, const Value& value)
+{
+    static_assert(sizeof(Value) % 8 == 0);
+    for (std::size_t word = 0; word < sizeof(Value) / 8; word++)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, reinterpret_cast<const unsigned char*>(&value) + word * 8, 8);
+        assembler.movImm(RAX, bits);
+        assembler.store(slotOffset(slot) + static_cast<std::int32_t>(word * 8), RAX);
+    }
+}
+
+// Leaves through exit unless the slot holds a number, like IS_NUMBER().
+void JitCompiler::guardNumber(const std::uint32_t slot, const std::uint32_t exit)
+{
+#ifdef CLOXX_NAN_BOXING
+    // A number does not have all the QNAN bits set: ~value & QNAN != 0. rdx holds QNAN.
+    assembler.load(RAX, slotOffset(slot));
+    assembler.bytes({0x48, 0xF7, 0xD0});    // not rax
+    assembler.bytes({0x48, 0x85, 0xD0});    // test rax, rdx
+    guards.push_back(Guard{assembler.jcc(CC_E), exit});
+#else
+    assembler.cmpByte(slotOffset(slot) + static_cast<std::int32_t>(offsetof(Value, type)), VAL_NUMBER);
+    guards.push_back(Guard{assembler.jcc(CC_NE), exit});
+#endif
+}
+
+// Stores BOOL_VAL(condition) computed from the flags of the last ucomisd.
+void JitCompiler::storeBool(const std::uint32_t slot, const Condition condition)
+{
+    assembler.setcc(condition);
+#ifdef CLOXX_NAN_BOXING
+    // TRUE_VAL is FALSE_VAL + 1.
+    assembler.bytes({0x0F, 0xB6, 0xC0});    // movzx eax, al
+    assembler.movImm(RDX, FALSE_VAL);
+    assembler.bytes({0x48, 0x01, 0xD0});    // add rax, rdx
+    assembler.store(slotOffset(slot), RAX);
+#else
+    assembler.storeByte(slotOffset(slot) + static_cast<std::int32_t>(offsetof(Value, type)), VAL_BOOL);
+    assembler.storeAl(slotOffset(slot) + NUMBER_OFFSET);
+#endif
+}
+
+// Operands in slots a and a + 1, result in slot a. Unchecked instructions
+// skip the operand checks and need no exit.
+void JitCompiler::binary(const std::uint8_t instruction, const std::uint32_t a, const bool checked,
+                         const std::uint32_t exit)
+{
+    const std::uint32_t b = a + 1;
+    if (checked)
+    {
+#ifdef CLOXX_NAN_BOXING
+        assembler.movImm(RDX, QNAN);
+#endif
+        guardNumber(b, exit);
+        guardNumber(a, exit);
+    }
+    assembler.movsdLoad(XMM0, slotOffset(a) + NUMBER_OFFSET);
+    assembler.movsdLoad(XMM1, slotOffset(b) + NUMBER_OFFSET);
+
+    // Unordered operands set CF and ZF, so "above" is false and "below or
+    // equal" is true for NaN, as with the C++ operators of BINARY_OP.
+    switch (instruction)
+    {
+    case OP_ADD:            assembler.arithmetic(0x58); break;
+    case OP_SUBTRACT:       assembler.arithmetic(0x5C); break;
+    case OP_MULTIPLY:       assembler.arithmetic(0x59); break;
+    case OP_DIVIDE:         assembler.arithmetic(0x5E); break;
+    case OP_GREATER:        assembler.ucomisd(XMM0, XMM1); storeBool(a, CC_A); return;  // a > b
+    case OP_LESS:           assembler.ucomisd(XMM1, XMM0); storeBool(a, CC_A); return;  // b > a
+    case OP_GREATER_EQUAL:  assembler.ucomisd(XMM1, XMM0); storeBool(a, CC_BE); return; // !(a < b)
+    case OP_LESS_EQUAL:     assembler.ucomisd(XMM0, XMM1); storeBool(a, CC_BE); return; // !(a > b)
+    default:                return;
+    }
+    assembler.movsdStore(slotOffset(a) + NUMBER_OFFSET, XMM0);
+}
+
+bool JitCompiler::compile(const ChunkView& chunk)
+{
+    if (chunk.code.size() > JIT_MAX_CHUNK_BYTES)
+    {
+        return false;
+    }
+    assembler.code.reserve(chunk.code.size() * 32);
+
+    assembler.bytes({0x53});                // push rbx, which also aligns the stack for calls
+    assembler.bytes({0x48, 0x89, 0xFB});    // mov rbx, rdi
+
+    std::uint32_t depth = 0;
+    std::size_t offset = 0;
+    for (;;)
+    {
+        if (offset >= chunk.code.size())
+        {
+            return false; // No OP_RETURN.
+        }
+
+        const std::uint8_t instruction = chunk.code[offset];
+        const auto at = static_cast<std::uint32_t>(offset);
+        if (instruction >= OP_COUNT || offset + instructionLength(instruction) > chunk.code.size())
+        {
+            return false;
+        }
+
+        // Unchecked instructions compile as their checked form without the checks.
+        const std::uint8_t operation = checkedOpcode(instruction);
+        const bool checked = operation == instruction;
+
+        // Operands the stack does not have, or a result it has no room for.
+        const int pops = operation == OP_RETURN || operation == OP_NOT || operation == OP_NEGATE ? 1
+                       : operation >= OP_EQUAL && operation <= OP_DIVIDE ? 2 : 0;
+        if (depth < static_cast<std::uint32_t>(pops) || (pops == 0 && depth >= STACK_MAX))
+        {
+            return false;
+        }
+
+        switch (operation)
+        {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        {
+            const std::uint32_t index = instruction == OP_CONSTANT ? chunk.code[offset + 1]
+                                                                   : readLongOperand(&chunk.code[offset + 1]);
+            if (index >= chunk.constants.size()) return false;
+            storeValue(depth++, chunk.constants[index]);
+            break;
+        }
+        case OP_NIL:    storeValue(depth++, NIL_VAL); break;
+        case OP_TRUE:   storeValue(depth++, BOOL_VAL(true)); break;
+        case OP_FALSE:  storeValue(depth++, BOOL_VAL(false)); break;
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+            depth--;
+            assembler.leaRdi(slotOffset(depth - 1));
+            assembler.call(reinterpret_cast<const void*>(instruction == OP_EQUAL ? &jitEqual : &jitNotEqual));
+            break;
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            binary(operation, depth - 2, checked, checked ? addExit(at, depth, false) : 0);
+            depth--;
+            break;
+        case OP_NOT:
+            assembler.leaRdi(slotOffset(depth - 1));
+            assembler.call(reinterpret_cast<const void*>(&jitNot));
+            break;
+        case OP_NEGATE:
+        {
+            if (checked)
+            {
+#ifdef CLOXX_NAN_BOXING
+                assembler.movImm(RDX, QNAN);
+#endif
+                guardNumber(depth - 1, addExit(at, depth, false));
+            }
+            assembler.xorByte(slotOffset(depth - 1) + NUMBER_OFFSET + 7, 0x80); // Flips the sign bit.
+            break;
+        }
+        case OP_RETURN:
+        {
+            const std::uint32_t exit = addExit(at, depth, true);
+            assembler.bytes({0xB8});        // mov eax, exit
+            assembler.imm32(exit);
+            const std::size_t epilogue = assembler.position();
+            assembler.bytes({0x5B, 0xC3});  // pop rbx; ret
+
+            // Out of line, the exits of the failed checks.
+            std::vector<std::size_t> stubs(exits.size(), 0);
+            for (const Guard& guard : guards)
+            {
+                if (stubs[guard.exit] == 0)
+                {
+                    stubs[guard.exit] = assembler.position();
+                    assembler.bytes({0xB8});
+                    assembler.imm32(guard.exit);
+                    assembler.patch(assembler.jmp(), epilogue);
+                }
+                assembler.patch(guard.patchAt, stubs[guard.exit]);
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+
+        offset += instructionLength(instruction);
+    }
+}
+
+#endif
+
+JitCode::~JitCode()
+{
+#ifdef CLOXX_HAS_JIT
+    if (memory != nullptr)
+    {
+        munmap(memory, codeSize);
+    }
+#endif
+}
+
+bool JitCode::isAvailable()
+{
+#ifdef CLOXX_HAS_JIT
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::unique_ptr<JitCode> JitCode::compile(const ChunkView& chunk)
+{
+#ifdef CLOXX_HAS_JIT
+    JitCompiler compiler;
+    if (!compiler.compile(chunk))
+    {
+        return nullptr;
+    }
+
+    // Written while writable, then only executable.
+    const std::vector<std::uint8_t>& code = compiler.assembler.code;
+    void* memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, code.size());
+        return nullptr;
+    }
+
+    std::unique_ptr<JitCode> jit(new JitCode());
+    jit->memory = memory;
+    jit->codeSize = code.size();
+    jit->entry = reinterpret_cast<Entry>(memory);
+    jit->exits = std::move(compiler.exits);
+    return jit;
+#else
+    (void)chunk;
+    return nullptr;
+#endif
+}
+
+const JitExit& JitCode::run(Value* stack) const
+{
+    return exits[entry(stack)];
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Chunk.h"
+#include "Value.h"
+
+// Runs of a CompiledChunk, over all VMs, before VM::run() compiles it to machine code.
+constexpr std::uint32_t JIT_HOT_RUNS = 16;
+
+// Larger chunks stay interpreted. Straight-line code runs every instruction once,
+// so their machine code would be fetched from memory at every run and lose to
+// the compact bytecode; about 30 bytes of machine code are emitted per byte.
+constexpr std::size_t JIT_MAX_CHUNK_BYTES = 64 * 1024;
+
+// Where the machine code of a chunk stopped: at its OP_RETURN, or at the
+// instruction whose operand check failed, for the interpreter to resume from.
+struct JitExit
+{
+    std::uint32_t offset;   // Code offset of the instruction.
+    std::uint32_t depth;    // Stack slots in use before it executes.
+    bool returned;
+};
+
+// Baseline JIT: translates the straight-line bytecode of a chunk into x86-64
+// code working on the VM stack in place. Stack depths are known at every
+// instruction, so each slot has a fixed address and no stack pointer is kept.
+// Number arithmetic and comparisons are inlined behind the same operand
+// checks as the interpreter; the rest calls back into C++.
+class JitCode
+{
+public:
+    ~JitCode();
+
+    JitCode(const JitCode&) = delete;
+    JitCode& operator=(const JitCode&) = delete;
+
+    // False on other architectures and platforms, where VM::run() interprets.
+    static bool isAvailable();
+
+    // Null when the JIT is not available, the chunk is malformed, larger than
+    // JIT_MAX_CHUNK_BYTES or needs a deeper stack than the VM has.
+    static std::unique_ptr<JitCode> compile(const ChunkView& chunk);
+
+    // stack must hold STACK_MAX values. The code may be run by several threads at once.
+    const JitExit& run(Value* stack) const;
+
+    std::size_t size() const { return codeSize; }
+
+private:
+    using Entry = std::uint32_t (*)(Value* stack); // Returns an index into exits.
+
+    void* memory = nullptr;
+    std::size_t codeSize = 0;
+    Entry entry = nullptr;
+    std::vector<JitExit> exits;
+
+    JitCode() = default;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "Scanner.h"
+
+// Perfect hash of the keywords TOKEN_AND...TOKEN_WHILE. The slot of a word only
+// depends on its first and last characters and its length, and the multiplier
+// is searched at compile time so that no two keywords share a slot.
+
+struct Keyword
+{
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr Keyword KEYWORDS[] =
+{
+    {"and", TOKEN_AND},         {"class", TOKEN_CLASS},     {"else", TOKEN_ELSE},
+    {"false", TOKEN_FALSE},     {"for", TOKEN_FOR},         {"fun", TOKEN_FUN},
+    {"if", TOKEN_IF},           {"nil", TOKEN_NIL},         {"or", TOKEN_OR},
+    {"print", TOKEN_PRINT},     {"return", TOKEN_RETURN},   {"super", TOKEN_SUPER},
+    {"this", TOKEN_THIS},       {"true", TOKEN_TRUE},       {"var", TOKEN_VAR},
+    {"while", TOKEN_WHILE},
+};
+
+constexpr int KEYWORD_SLOT_BITS = 5;
+constexpr std::size_t KEYWORD_MIN_LENGTH = 2;
+constexpr std::size_t KEYWORD_MAX_LENGTH = 6;
+
+constexpr std::uint32_t keywordSlot(const std::uint32_t seed, const char* start, const std::size_t length)
+{
+    std::uint32_t key = static_cast<unsigned char>(start[0]) |
+                        static_cast<unsigned char>(start[length - 1]) << 8 |
+                        static_cast<std::uint32_t>(length) << 16;
+    key *= 0x9E3779B1u;
+    key ^= key >> 15;
+    return (key * seed) >> (32 - KEYWORD_SLOT_BITS);
+}
+
+constexpr std::uint32_t KEYWORD_SEED = []
+{
+    for (std::uint32_t seed = 1;; seed += 2)
+    {
+        std::array<bool, 1 << KEYWORD_SLOT_BITS> used{};
+        bool perfect = true;
+        for (const Keyword& keyword : KEYWORDS)
+        {
+            const std::uint32_t slot = keywordSlot(seed, keyword.text.data(), keyword.text.size());
+            perfect = perfect && !used[slot];
+            used[slot] = true;
+        }
+
+        if (perfect) return seed;
+    }
+}();
+
+constexpr std::array<Keyword, 1 << KEYWORD_SLOT_BITS> KEYWORD_TABLE = []
+{
+    std::array<Keyword, 1 << KEYWORD_SLOT_BITS> table{};
+    table.fill(Keyword{"", TOKEN_IDENTIFIER});
+    for (const Keyword& keyword : KEYWORDS)
+    {
+        table[keywordSlot(KEYWORD_SEED, keyword.text.data(), keyword.text.size())] = keyword;
+    }
+    return table;
+}();
+
+inline TokenType keywordType(const char* start, const std::size_t length)
+{
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH)
+    {
+        return TOKEN_IDENTIFIER;
+    }
+
+    const Keyword& keyword = KEYWORD_TABLE[keywordSlot(KEYWORD_SEED, start, length)];
+    if (keyword.text.size() == length && std::memcmp(keyword.text.data(), start, length) == 0)
+    {
+        return keyword.type;
+    }
+
+    return TOKEN_IDENTIFIER;
+}
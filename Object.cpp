@@ -0,0 +1,166 @@
+#include "Object.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+
+#include "StringTable.h"
+#include "Value.h"
+
+// The table of makeString() and concatenate(), shared by every thread. Lookups
+// hold lock shared, so that threads finding strings already interned do not
+// wait on each other; an insertion holds it exclusively and looks up again,
+// since another thread may have inserted the string in between.
+struct SharedStringTable
+{
+    std::shared_mutex lock;
+    StringTable table;
+};
+
+static SharedStringTable& strings()
+{
+    static SharedStringTable shared;
+    return shared;
+}
+
+// Copies head and tail into a new buffer with room for capacity bytes.
+static ObjString* newString(const std::uint32_t hash, const std::string_view head, const std::string_view tail,
+                            const std::size_t capacity)
+{
+    auto* buffer = new StringBuffer{std::make_unique<char[]>(capacity), capacity, head.size() + tail.size()};
+    std::memcpy(buffer->chars.get(), head.data(), head.size());
+    std::memcpy(buffer->chars.get() + head.size(), tail.data(), tail.size());
+    return new ObjString{buffer->chars.get(), static_cast<std::uint32_t>(buffer->used), hash, buffer, nullptr,
+                         GC_PERMANENT};
+}
+
+std::uint32_t hashString(const char* chars, const std::size_t length, const std::uint32_t seed)
+{
+    std::uint32_t hash = seed;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<std::uint8_t>(chars[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+Value makeString(const char* chars, const std::size_t length)
+{
+    if (length <= SHORT_STRING_MAX)
+    {
+        return SHORT_STRING_VAL(packShortString(chars, length));
+    }
+
+    const std::uint32_t hash = hashString(chars, length);
+    const std::string_view text(chars, length);
+
+    if (ObjString* interned = findString(hash, text, {}))
+    {
+        return OBJ_STRING_VAL(interned);
+    }
+
+    SharedStringTable& shared = strings();
+    std::lock_guard<std::shared_mutex> guard(shared.lock);
+    if (ObjString* interned = shared.table.find(hash, text, {}))
+    {
+        return OBJ_STRING_VAL(interned);
+    }
+
+    // Sized exactly: most literals are never appended to.
+    ObjString* string = newString(hash, text, {}, length);
+    shared.table.insert(string);
+    return OBJ_STRING_VAL(string);
+}
+
+bool concatenate(const Value& a, const Value& b, Value* result)
+{
+    char scratchA[SHORT_STRING_MAX];
+    char scratchB[SHORT_STRING_MAX];
+    const std::string_view head = stringChars(a, scratchA);
+    const std::string_view tail = stringChars(b, scratchB);
+    const std::size_t length = head.size() + tail.size();
+    if (length > MAX_STRING_LENGTH)
+    {
+        return false;
+    }
+
+    if (length <= SHORT_STRING_MAX)
+    {
+        char chars[SHORT_STRING_MAX];
+        std::copy(head.begin(), head.end(), chars);
+        std::copy(tail.begin(), tail.end(), chars + head.size());
+        *result = SHORT_STRING_VAL(packShortString(chars, length));
+        return true;
+    }
+
+    const std::uint32_t headHash = IS_OBJ_STRING(a) ? AS_OBJ_STRING(a)->hash : hashString(head.data(), head.size());
+    const std::uint32_t hash = hashString(tail.data(), tail.size(), headHash);
+
+    if (ObjString* interned = findString(hash, head, tail))
+    {
+        *result = OBJ_STRING_VAL(interned);
+        return true;
+    }
+
+    SharedStringTable& shared = strings();
+    std::lock_guard<std::shared_mutex> guard(shared.lock);
+    if (ObjString* interned = shared.table.find(hash, head, tail))
+    {
+        *result = OBJ_STRING_VAL(interned);
+        return true;
+    }
+
+    ObjString* string;
+    // The buffer of a Heap string is only ever appended to by its own VM.
+    StringBuffer* buffer = IS_OBJ_STRING(a) ? AS_OBJ_STRING(a)->buffer : nullptr;
+    if (buffer != nullptr && buffer->owner == nullptr &&
+        head.data() + head.size() == buffer->chars.get() + buffer->used &&
+        buffer->capacity - buffer->used >= tail.size())
+    {
+        std::memcpy(buffer->chars.get() + buffer->used, tail.data(), tail.size());
+        buffer->used += tail.size();
+        string = new ObjString{head.data(), static_cast<std::uint32_t>(length), hash, buffer, nullptr, GC_PERMANENT};
+    }
+    else
+    {
+        // Room to double, so that a chain appends in place from here on.
+        string = newString(hash, head, tail, std::min(length * 2, MAX_STRING_LENGTH));
+    }
+
+    shared.table.insert(string);
+    *result = OBJ_STRING_VAL(string);
+    return true;
+}
+
+ObjString* findString(const std::uint32_t hash, const std::string_view head, const std::string_view tail)
+{
+    SharedStringTable& shared = strings();
+    std::shared_lock<std::shared_mutex> guard(shared.lock);
+    return shared.table.find(hash, head, tail);
+}
+
+bool stringsEqual(const ObjString* a, const ObjString* b)
+{
+    return a->hash == b->hash && a->length == b->length && std::memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+std::string_view stringChars(const Value& value, char (&scratch)[SHORT_STRING_MAX])
+{
+    if (IS_OBJ_STRING(value))
+    {
+        const ObjString* string = AS_OBJ_STRING(value);
+        return {string->chars, string->length};
+    }
+
+    const std::uint64_t bits = AS_SHORT_STRING(value);
+    const std::size_t length = shortStringLength(bits);
+    for (std::size_t i = 0; i < length; i++)
+    {
+        scratch[i] = static_cast<char>(bits >> (8 * i));
+    }
+    return {scratch, length};
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "Value.h"
+
+struct StringBuffer;
+
+// Tri-color state of a string during a collection of its Heap. Strings hold no
+// references, so marking one turns it black at once: it is never gray.
+enum GcColor: std::uint8_t
+{
+    GC_WHITE,       // Not reached yet; freed by the sweep if it stays so.
+    GC_BLACK,       // Reached, or allocated while marking.
+    GC_PERMANENT,   // In the process-wide table, never collected.
+};
+
+// A string too long to be short. Those of the host and of literals are
+// interned in a table shared by the whole process and live until it exits,
+// unless the literals are compiled into a Heap (see CompilerOptions::heap).
+// Those a VM builds while running belong to its Heap, interned there and freed
+// once unreachable, unless the process-wide table already holds them. Equal
+// strings of one table are the same object, so most comparisons stop at the
+// address; across tables they compare by content.
+struct ObjString
+{
+    const char* chars;      // Not NUL-terminated.
+    std::uint32_t length;
+    std::uint32_t hash;     // hashString() of chars.
+    StringBuffer* buffer;   // Holds chars, maybe followed by the rest of longer strings built on this one.
+    ObjString* next;        // Next string of the same Heap.
+    GcColor color;
+};
+
+constexpr std::size_t MAX_STRING_LENGTH = UINT32_MAX;
+
+// 32-bit FNV-1a, continuing from seed: hashing b from the hash of a gives the hash of a + b.
+std::uint32_t hashString(const char* chars, std::size_t length, std::uint32_t seed = 2166136261u);
+
+// A string value of length chars, at most MAX_STRING_LENGTH. Long strings are
+// looked up where they are, so chars are only copied the first time a string
+// is seen: a literal found in the table costs no copy or allocation.
+Value makeString(const char* chars, std::size_t length);
+
+// The string a + b, interned process-wide like makeString(): for the compiler
+// folding constants. Runs concatenate with Heap::concatenate(). Appends in place
+// when a is the longest string built in its buffer, so a chain of
+// concatenations copies each piece once rather than every prefix. Fails when
+// the result would be longer than MAX_STRING_LENGTH.
+bool concatenate(const Value& a, const Value& b, Value* result);
+
+// The string head + tail from the process-wide table, or null if it is not
+// there. hash is that of the whole string.
+ObjString* findString(std::uint32_t hash, std::string_view head, std::string_view tail);
+
+// Characters of a string value; those of a short string are unpacked into scratch.
+std::string_view stringChars(const Value& value, char (&scratch)[SHORT_STRING_MAX]);
@@ -0,0 +1,116 @@
+#include "Peephole.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Chunk.h"
+
+static bool producesNumber(const std::uint8_t instruction)
+{
+    // A checked OP_ADD may concatenate strings.
+    if (instruction == OP_ADD_UNCHECKED)
+    {
+        return true;
+    }
+
+    switch (checkedOpcode(instruction))
+    {
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NEGATE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Fused comparison for a comparison followed by OP_NOT, and back.
+static bool negatedComparison(const std::uint8_t instruction, std::uint8_t* negated)
+{
+    switch (instruction)
+    {
+    case OP_EQUAL:          *negated = OP_NOT_EQUAL; return true;
+    case OP_NOT_EQUAL:      *negated = OP_EQUAL; return true;
+    case OP_LESS:           *negated = OP_GREATER_EQUAL; return true;
+    case OP_GREATER_EQUAL:  *negated = OP_LESS; return true;
+    case OP_GREATER:        *negated = OP_LESS_EQUAL; return true;
+    case OP_LESS_EQUAL:     *negated = OP_GREATER; return true;
+    case OP_LESS_UNCHECKED:             *negated = OP_GREATER_EQUAL_UNCHECKED; return true;
+    case OP_GREATER_EQUAL_UNCHECKED:    *negated = OP_LESS_UNCHECKED; return true;
+    case OP_GREATER_UNCHECKED:          *negated = OP_LESS_EQUAL_UNCHECKED; return true;
+    case OP_LESS_EQUAL_UNCHECKED:       *negated = OP_GREATER_UNCHECKED; return true;
+    default:                return false;
+    }
+}
+
+// Rewrites the finished chunk in a single pass, looking back at the
+// instructions already kept:
+//   comparison, OP_NOT          -> fused comparison (OP_NOT_EQUAL, ...)
+//   OP_NOT, OP_NOT, OP_NOT      -> OP_NOT
+//   number op, OP_NEGATE x2     -> number op
+//   OP_NEGATE_UNCHECKED x2      -> nothing
+// Only rewrites that keep every result and runtime error are applied: a lone
+// OP_NOT, OP_NOT still turns its operand into a bool, and a double negation is
+// only dropped once an earlier instruction has checked the operand is a number,
+// or the compiler has proved it is.
+// There are no jumps yet, so instructions can be removed without relocation.
+void optimizeChunk(Chunk& chunk)
+{
+    // Same resource as chunk, so that the moves below do not copy.
+    Chunk rewritten(chunk.resource());
+    std::pmr::vector<std::size_t> starts(chunk.resource()); // Offsets of the instructions kept in rewritten.
+    rewritten.code.reserve(chunk.code.size());
+    starts.reserve(chunk.code.size());
+
+    const auto last = [&](const std::size_t distance) -> int
+    {
+        return starts.size() > distance ? rewritten.code[starts[starts.size() - 1 - distance]] : -1;
+    };
+    const auto dropLast = [&]()
+    {
+        rewritten.truncate(starts.back());
+        starts.pop_back();
+    };
+
+    for (std::size_t offset = 0; offset < chunk.code.size();)
+    {
+        const std::uint8_t instruction = chunk.code[offset];
+        const std::size_t length = instructionLength(instruction);
+
+        std::uint8_t negated;
+        if (instruction == OP_NOT && last(0) >= 0 && negatedComparison(last(0), &negated))
+        {
+            rewritten.code[starts.back()] = negated;
+        }
+        else if (instruction == OP_NOT && last(0) == OP_NOT && last(1) == OP_NOT)
+        {
+            dropLast();
+        }
+        else if (instruction == OP_NEGATE && last(0) == OP_NEGATE && last(1) >= 0 && producesNumber(last(1)))
+        {
+            dropLast();
+        }
+        else if (instruction == OP_NEGATE_UNCHECKED && last(0) == OP_NEGATE_UNCHECKED)
+        {
+            dropLast();
+        }
+        else
+        {
+            starts.push_back(rewritten.code.size());
+            const int line = chunk.getLine(offset);
+            for (std::size_t i = 0; i < length; i++)
+            {
+                rewritten.writeChunk(chunk.code[offset + i], line);
+            }
+        }
+
+        offset += length;
+    }
+
+    rewritten.constants = std::move(chunk.constants);
+    rewritten.globals = std::move(chunk.globals);
+    chunk = std::move(rewritten);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "Chunk.h"
+
+void optimizeChunk(Chunk& chunk);
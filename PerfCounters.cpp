@@ -0,0 +1,183 @@
+#include "PerfCounters.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define CLOXX_HAS_PERF_EVENTS
+#endif
+
+const char* perfEventName(const PerfEvent event)
+{
+    switch (event)
+    {
+    case PERF_CYCLES:           return "cycles";
+    case PERF_INSTRUCTIONS:     return "instructions";
+    case PERF_BRANCH_MISSES:    return "branch_misses";
+    case PERF_L1D_MISSES:       return "l1d_misses";
+    case PERF_LLC_MISSES:       return "llc_misses";
+    default:                    return "unknown";
+    }
+}
+
+PerfCounts& PerfCounts::operator+=(const PerfCounts& other)
+{
+    for (int i = 0; i < PERF_EVENT_COUNT; i++)
+    {
+        values[i] += other.values[i];
+    }
+    return *this;
+}
+
+PerfCounts PerfCounts::operator-(const PerfCounts& other) const
+{
+    PerfCounts difference;
+    for (int i = 0; i < PERF_EVENT_COUNT; i++)
+    {
+        difference.values[i] = values[i] - other.values[i];
+    }
+    return difference;
+}
+
+PerfCounters::~PerfCounters()
+{
+    close();
+}
+
+#ifdef CLOXX_HAS_PERF_EVENTS
+static perf_event_attr eventAttributes(const PerfEvent event)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    // Kernel and hypervisor events need privileges and are not ours anyway.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    switch (event)
+    {
+    case PERF_CYCLES:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_INSTRUCTIONS:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERF_BRANCH_MISSES:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case PERF_L1D_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PERF_LLC_MISSES:
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    default:
+        break;
+    }
+    return attr;
+}
+#endif
+
+// All events share one group so that a single read() returns them together and
+// the kernel schedules them on the same instructions.
+bool PerfCounters::open()
+{
+    close();
+
+#ifdef CLOXX_HAS_PERF_EVENTS
+    int firstError = 0;
+    for (int i = 0; i < PERF_EVENT_COUNT; i++)
+    {
+        const PerfEvent event = static_cast<PerfEvent>(i);
+        perf_event_attr attr = eventAttributes(event);
+        attr.disabled = leader < 0 ? 1 : 0;
+
+        const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+        if (fd < 0)
+        {
+            if (firstError == 0) firstError = errno;
+            continue;
+        }
+
+        if (leader < 0) leader = fd;
+        fds[event] = fd;
+        order[opened++] = event;
+    }
+
+    if (leader < 0)
+    {
+        errorMessage = std::string("perf_event_open failed: ") + std::strerror(firstError);
+        return false;
+    }
+
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+#else
+    errorMessage = "Hardware performance counters are only supported on Linux.";
+    return false;
+#endif
+}
+
+void PerfCounters::read(PerfCounts* counts) const
+{
+    *counts = PerfCounts{};
+
+#ifdef CLOXX_HAS_PERF_EVENTS
+    if (leader < 0) return;
+
+    // PERF_FORMAT_GROUP layout: the number of events, then one value per event.
+    std::uint64_t buffer[1 + PERF_EVENT_COUNT];
+    const ssize_t size = ::read(leader, buffer, sizeof(buffer));
+    if (size < static_cast<ssize_t>(sizeof(std::uint64_t))) return;
+
+    const std::uint64_t count = buffer[0] < static_cast<std::uint64_t>(opened) ? buffer[0] : opened;
+    for (std::uint64_t i = 0; i < count; i++)
+    {
+        counts->values[order[i]] = buffer[1 + i];
+    }
+#endif
+}
+
+void PerfCounters::close()
+{
+#ifdef CLOXX_HAS_PERF_EVENTS
+    for (int& fd : fds)
+    {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+#endif
+    leader = -1;
+    opened = 0;
+}
+
+PerfScope::PerfScope(const PerfCounters* counters, PerfCounts* total)
+    : counters(counters != nullptr && counters->isOpen() ? counters : nullptr)
+    , total(total)
+{
+    if (this->counters != nullptr)
+    {
+        this->counters->read(&start);
+    }
+}
+
+PerfScope::~PerfScope()
+{
+    if (counters != nullptr)
+    {
+        PerfCounts end;
+        counters->read(&end);
+        *total += end - start;
+    }
+}
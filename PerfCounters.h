@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Hardware events counted in user space, in the order of PerfCounts::values.
+enum PerfEvent: std::uint8_t
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,        // L1 data cache read misses.
+    PERF_LLC_MISSES,        // Last level cache misses.
+
+    PERF_EVENT_COUNT,
+};
+
+const char* perfEventName(PerfEvent event);
+
+struct PerfCounts
+{
+    std::array<std::uint64_t, PERF_EVENT_COUNT> values{};
+
+    PerfCounts& operator+=(const PerfCounts& other);
+    PerfCounts operator-(const PerfCounts& other) const;
+};
+
+// Linux perf_event_open counters shared by the compiler and VM phases and the
+// profiler. Events the kernel refuses, in containers or virtual machines for
+// instance, are left out and read as zero; open() only fails when none is left.
+class PerfCounters
+{
+public:
+    PerfCounters() = default;
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool open();
+    bool isOpen() const { return leader >= 0; }
+    bool has(const PerfEvent event) const { return fds[event] >= 0; }
+    const std::string& error() const { return errorMessage; }
+
+    // Totals since open(), phases are measured by difference.
+    void read(PerfCounts* counts) const;
+
+private:
+    std::array<int, PERF_EVENT_COUNT> fds{-1, -1, -1, -1, -1};
+    int leader = -1;
+    std::array<PerfEvent, PERF_EVENT_COUNT> order{}; // Events in group read order.
+    int opened = 0;
+    std::string errorMessage;
+
+    void close();
+};
+
+// Adds the events counted during its lifetime to total. Does nothing without
+// open counters.
+class PerfScope
+{
+public:
+    PerfScope(const PerfCounters* counters, PerfCounts* total);
+    ~PerfScope();
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    const PerfCounters* counters;
+    PerfCounts* total;
+    PerfCounts start;
+};
@@ -0,0 +1,259 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "Chunk.h"
+#include "Common.h"
+#include "Debug.h"
+#include "PerfCounters.h"
+
+const char* Profiler::tickUnit()
+{
+#ifdef CLOXX_HAS_RDTSC
+    return "cycles";
+#else
+    return "ns";
+#endif
+}
+
+void Profiler::setPerfCounters(const PerfCounters* counters)
+{
+    perf = counters != nullptr && counters->isOpen() ? counters : nullptr;
+}
+
+void Profiler::begin(const ChunkView& c)
+{
+    chunk = c;
+    offsets.assign(chunk.code.size(), Totals{});
+    current = NO_INSTRUCTION;
+    rerun = false;
+    runs++;
+}
+
+void Profiler::end()
+{
+    if (current != NO_INSTRUCTION)
+    {
+        const std::uint64_t ticks = now() - start;
+        offsets[current].ticks += ticks;
+        opcodes[previous].ticks += ticks;
+        if (perf != nullptr)
+        {
+            PerfCounts perfStop;
+            perf->read(&perfStop);
+            opcodePerf[previous] += perfStop - perfStart;
+        }
+        current = NO_INSTRUCTION;
+    }
+
+    for (std::size_t offset = 0; offset < offsets.size(); offset++)
+    {
+        const Totals& totals = offsets[offset];
+        if (totals.count == 0) continue;
+
+        Totals& line = lines[chunk.getLine(offset)];
+        line.count += totals.count;
+        line.ticks += totals.ticks;
+    }
+
+    offsets.clear();
+    chunk = ChunkView{};
+}
+
+// Most frequent first.
+std::vector<Profiler::OpcodePair> Profiler::sortedPairs() const
+{
+    std::vector<OpcodePair> sorted;
+    for (int first = 0; first < OP_COUNT; first++)
+    {
+        for (int second = 0; second < OP_COUNT; second++)
+        {
+            if (pairs[first][second] == 0) continue;
+            sorted.push_back(OpcodePair{static_cast<std::uint8_t>(first), static_cast<std::uint8_t>(second),
+                                  pairs[first][second]});
+        }
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const OpcodePair& a, const OpcodePair& b) { return a.count > b.count; });
+    return sorted;
+}
+
+bool Profiler::hasQuickening() const
+{
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        if (quickenedOpcode(op) != op && opcodes[quickenedOpcode(op)].count + rewrites[quickenedOpcode(op)] > 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Profiler::printTable(std::FILE* out) const
+{
+    std::uint64_t totalTicks = 0;
+    for (const Totals& totals : opcodes) totalTicks += totals.ticks;
+    const double percent = totalTicks > 0 ? 100.0 / static_cast<double>(totalTicks) : 0;
+
+    std::vector<int> order;
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        if (opcodes[op].count > 0) order.push_back(op);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [this](const int a, const int b) { return opcodes[a].ticks > opcodes[b].ticks; });
+
+    fprintf(out, "== opcodes (%llu runs, %s) ==\n", static_cast<unsigned long long>(runs), tickUnit());
+    fprintf(out, "%-26s %14s %16s %10s %7s\n", "opcode", "count", "ticks", "per exec", "%");
+    for (const int op : order)
+    {
+        const Totals& totals = opcodes[op];
+        fprintf(out, "%-26s %14llu %16llu %10.1f %6.1f%%\n", opcodeName(op),
+                static_cast<unsigned long long>(totals.count), static_cast<unsigned long long>(totals.ticks),
+                static_cast<double>(totals.ticks) / static_cast<double>(totals.count),
+                static_cast<double>(totals.ticks) * percent);
+    }
+
+    if (perf != nullptr)
+    {
+        fprintf(out, "== opcode perf counters (per execution) ==\n");
+        fprintf(out, "%-26s", "opcode");
+        for (int event = 0; event < PERF_EVENT_COUNT; event++)
+        {
+            fprintf(out, " %14s", perfEventName(static_cast<PerfEvent>(event)));
+        }
+        fprintf(out, "\n");
+
+        for (const int op : order)
+        {
+            fprintf(out, "%-26s", opcodeName(op));
+            for (int event = 0; event < PERF_EVENT_COUNT; event++)
+            {
+                if (!perf->has(static_cast<PerfEvent>(event)))
+                {
+                    fprintf(out, " %14s", "-");
+                    continue;
+                }
+                fprintf(out, " %14.2f", static_cast<double>(opcodePerf[op].values[event]) /
+                                        static_cast<double>(opcodes[op].count));
+            }
+            fprintf(out, "\n");
+        }
+    }
+
+    // The pairs worth a superinstruction are at the top, the tail is noise.
+    constexpr std::size_t MAX_PAIRS = 20;
+    const std::vector<OpcodePair> sorted = sortedPairs();
+    fprintf(out, "== opcode pairs ==\n");
+    fprintf(out, "%-26s %-26s %14s\n", "first", "second", "count");
+    for (std::size_t i = 0; i < sorted.size() && i < MAX_PAIRS; i++)
+    {
+        fprintf(out, "%-26s %-26s %14llu\n", opcodeName(sorted[i].first), opcodeName(sorted[i].second),
+                static_cast<unsigned long long>(sorted[i].count));
+    }
+
+    // Hits are executions of the quickened form whose guard held, out of all
+    // executions of the operation in either form.
+    if (hasQuickening())
+    {
+        fprintf(out, "== quickening ==\n");
+        fprintf(out, "%-26s %14s %14s %7s %10s %14s\n", "opcode", "generic", "quickened", "hits", "rewrites",
+                "despecialized");
+        for (int op = 0; op < OP_COUNT; op++)
+        {
+            const int quick = quickenedOpcode(op);
+            if (quick == op) continue;
+
+            const std::uint64_t total = opcodes[op].count + opcodes[quick].count;
+            if (total == 0) continue;
+            fprintf(out, "%-26s %14llu %14llu %6.1f%% %10llu %14llu\n", opcodeName(op),
+                    static_cast<unsigned long long>(opcodes[op].count),
+                    static_cast<unsigned long long>(opcodes[quick].count),
+                    100.0 * static_cast<double>(opcodes[quick].count - despecializations[quick]) /
+                        static_cast<double>(total),
+                    static_cast<unsigned long long>(rewrites[quick]),
+                    static_cast<unsigned long long>(despecializations[quick]));
+        }
+    }
+
+    fprintf(out, "== lines ==\n");
+    fprintf(out, "%-8s %14s %16s %7s\n", "line", "count", "ticks", "%");
+    for (const auto& [line, totals] : lines)
+    {
+        fprintf(out, "%-8d %14llu %16llu %6.1f%%\n", line, static_cast<unsigned long long>(totals.count),
+                static_cast<unsigned long long>(totals.ticks), static_cast<double>(totals.ticks) * percent);
+    }
+}
+
+// Appends a "perf" member holding the events that could be counted.
+static void writePerfJson(std::FILE* out, const PerfCounters& perf, const PerfCounts& counts)
+{
+    fprintf(out, ", \"perf\": {");
+    const char* separator = "";
+    for (int event = 0; event < PERF_EVENT_COUNT; event++)
+    {
+        if (!perf.has(static_cast<PerfEvent>(event))) continue;
+        fprintf(out, "%s\"%s\": %llu", separator, perfEventName(static_cast<PerfEvent>(event)),
+                static_cast<unsigned long long>(counts.values[event]));
+        separator = ", ";
+    }
+    fprintf(out, "}");
+}
+
+void Profiler::writeJson(std::FILE* out) const
+{
+    fprintf(out, "{\n  \"unit\": \"%s\",\n  \"runs\": %llu,\n  \"opcodes\": [", tickUnit(),
+            static_cast<unsigned long long>(runs));
+    const char* separator = "\n";
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        if (opcodes[op].count == 0) continue;
+        fprintf(out, "%s    {\"opcode\": \"%s\", \"count\": %llu, \"ticks\": %llu", separator, opcodeName(op),
+                static_cast<unsigned long long>(opcodes[op].count),
+                static_cast<unsigned long long>(opcodes[op].ticks));
+        if (perf != nullptr)
+        {
+            writePerfJson(out, *perf, opcodePerf[op]);
+        }
+        fprintf(out, "}");
+        separator = ",\n";
+    }
+
+    fprintf(out, "\n  ],\n  \"pairs\": [");
+    separator = "\n";
+    for (const OpcodePair& pair : sortedPairs())
+    {
+        fprintf(out, "%s    {\"first\": \"%s\", \"second\": \"%s\", \"count\": %llu}", separator,
+                opcodeName(pair.first), opcodeName(pair.second), static_cast<unsigned long long>(pair.count));
+        separator = ",\n";
+    }
+
+    fprintf(out, "\n  ],\n  \"quickening\": [");
+    separator = "\n";
+    for (int op = 0; hasQuickening() && op < OP_COUNT; op++)
+    {
+        const int quick = quickenedOpcode(op);
+        if (quick == op || opcodes[op].count + opcodes[quick].count == 0) continue;
+        fprintf(out, "%s    {\"opcode\": \"%s\", \"generic\": %llu, \"quickened\": %llu, \"rewrites\": %llu, "
+                "\"despecialized\": %llu}", separator, opcodeName(op),
+                static_cast<unsigned long long>(opcodes[op].count), static_cast<unsigned long long>(opcodes[quick].count),
+                static_cast<unsigned long long>(rewrites[quick]),
+                static_cast<unsigned long long>(despecializations[quick]));
+        separator = ",\n";
+    }
+
+    fprintf(out, "\n  ],\n  \"lines\": [");
+    separator = "\n";
+    for (const auto& [line, totals] : lines)
+    {
+        fprintf(out, "%s    {\"line\": %d, \"count\": %llu, \"ticks\": %llu}", separator, line,
+                static_cast<unsigned long long>(totals.count), static_cast<unsigned long long>(totals.ticks));
+        separator = ",\n";
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
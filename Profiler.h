@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include "Chunk.h"
+#include "Common.h"
+#include "PerfCounters.h"
+
+#ifdef CLOXX_HAS_RDTSC
+#include <x86intrin.h>
+#endif
+
+// Execution profile filled by the profiled instantiation of the VM run loop:
+// counts and time per opcode, counts of consecutive opcode pairs, totals per
+// source line and how well quickened instructions hold. Profiles of successive
+// runs accumulate.
+class Profiler
+{
+public:
+    // Time stamp counter cycles when available, steady clock nanoseconds otherwise.
+    static std::uint64_t now();
+    static const char* tickUnit();
+
+    // Also attributes hardware events to opcodes. Reading the counters costs a
+    // system call per instruction, so ticks are inflated when this is set.
+    void setPerfCounters(const PerfCounters* counters);
+
+    void begin(const ChunkView& chunk);
+    inline void enter(std::size_t offset, std::uint8_t instruction);
+    void end();
+
+    // An instruction was rewritten into its quickened form, or back. The VM
+    // then runs the generic form at the same offset: the guard miss and that
+    // run count as one execution of the quickened instruction.
+    void quickened(std::uint8_t quick) { rewrites[quick]++; }
+    void despecialized(const std::uint8_t quick)
+    {
+        despecializations[quick]++;
+        rerun = true;
+    }
+
+    void printTable(std::FILE* out) const;
+    void writeJson(std::FILE* out) const;
+
+private:
+    struct Totals
+    {
+        std::uint64_t count = 0;
+        std::uint64_t ticks = 0;
+    };
+
+    struct OpcodePair
+    {
+        std::uint8_t first;
+        std::uint8_t second;
+        std::uint64_t count;
+    };
+
+    static constexpr std::size_t NO_INSTRUCTION = SIZE_MAX;
+
+    // State of the running chunk, folded into the totals below by end().
+    ChunkView chunk{};
+    std::vector<Totals> offsets;
+    std::size_t current = NO_INSTRUCTION;
+    std::uint8_t previous = 0;
+    std::uint64_t start = 0;
+    bool rerun = false;                 // The next enter() runs the current instruction again.
+
+    const PerfCounters* perf = nullptr;
+    PerfCounts perfStart;
+
+    std::uint64_t runs = 0;
+    std::array<Totals, OP_COUNT> opcodes{};
+    std::array<PerfCounts, OP_COUNT> opcodePerf{};
+    std::array<std::array<std::uint64_t, OP_COUNT>, OP_COUNT> pairs{};
+    std::map<int, Totals> lines;
+    std::array<std::uint64_t, OP_COUNT> rewrites{};
+    std::array<std::uint64_t, OP_COUNT> despecializations{};
+
+    std::vector<OpcodePair> sortedPairs() const;
+    bool hasQuickening() const;
+};
+
+inline std::uint64_t Profiler::now()
+{
+#ifdef CLOXX_HAS_RDTSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Called before each instruction. Lines are looked up once per offset when the
+// run ends. Opcodes are counted here because quickening rewrites them while the
+// chunk runs.
+inline void Profiler::enter(const std::size_t offset, const std::uint8_t instruction)
+{
+    if (rerun)
+    {
+        rerun = false;
+        return;
+    }
+
+    const std::uint64_t stop = now();
+    if (current != NO_INSTRUCTION)
+    {
+        offsets[current].ticks += stop - start;
+        opcodes[previous].ticks += stop - start;
+        pairs[previous][instruction]++;
+    }
+
+    if (perf != nullptr)
+    {
+        PerfCounts perfStop;
+        perf->read(&perfStop);
+        if (current != NO_INSTRUCTION)
+        {
+            opcodePerf[previous] += perfStop - perfStart;
+        }
+    }
+
+    offsets[offset].count++;
+    opcodes[instruction].count++;
+    current = offset;
+    previous = instruction;
+
+    // Leaves the bookkeeping above out of the next instruction.
+    if (perf != nullptr)
+    {
+        perf->read(&perfStart);
+    }
+    start = now();
+}
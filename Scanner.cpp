@@ -3,24 +3,26 @@
 #include <cstring>
 
 #include "Source.h"
+#include "CharClass.h"
+#include "Keywords.h"
 
-Scanner::Scanner(const Source& source)
+Scanner::Scanner(const Source& source, const ScanKernel kernel)
     : start(source[0])
     , current(source[0])
+    , end(source.end())
     , line(1)
+    , kernels(&getScanKernels(kernel))
 {
 }
 
 bool Scanner::isDigit(const char c)
 {
-    return c >= '0' && c <= '9';
+    return hasCharClass(c, CHAR_DIGIT);
 }
 
 bool Scanner::isAlpha(const char c)
 {
-    return  (c >= 'a' && c <= 'z') ||
-            (c >= 'A' && c <= 'Z') ||
-            c == '_';
+    return hasCharClass(c, CHAR_ALPHA);
 }
 
 Token Scanner::nextToken()
@@ -63,9 +65,10 @@ Token Scanner::nextToken()
     return errorToken("Unexpected character.");
 }
 
+// The source has no terminating NUL, reads past the end see '\0' instead.
 bool Scanner::isAtEnd() const
 {
-    return *current == '\0';
+    return current >= end;
 }
 
 Token Scanner::makeToken(const TokenType type) const
@@ -96,46 +99,32 @@ void Scanner::skipWhitespace()
 {
     for (;;)
     {
-        const char c = peek();
-        switch(c)
+        current = kernels->skipWhitespace(current, end, &line);
+
+        if (peek() != '/' || peekNext() != '/')
         {
-        case ' ':
-        case '\r':
-        case '\t':
-            advance();
-            break;
-        case '\n':
-            line++;
-            advance();
-            break;
-        case '/':
-            if (peekNext() == '/')
-                while (peek() != '\n' && !isAtEnd()) advance();
-            else
-                return;
-        default:
             return;
         }
+
+        // A comment goes until the end of the line.
+        current = kernels->findNewline(current, end);
     }
 }
 
 char Scanner::peek() const
 {
+    if (isAtEnd()) return '\0';
     return *current;
 }
 
 char Scanner::peekNext() const {
-    if (isAtEnd()) return '\0';
+    if (current + 1 >= end) return '\0';
     return current[1];
 }
 
 Token Scanner::string()
 {
-    while (peek() != '"' && !isAtEnd())
-    {
-        if (peek() == '\n') line++;
-        advance();
-    }
+    current = kernels->findQuote(current, end, &line);
 
     if (isAtEnd()) return errorToken("Unterminated string.");
 
@@ -145,13 +134,13 @@ Token Scanner::string()
 
 Token Scanner::number()
 {
-    while (isDigit(peek())) advance();
+    current = kernels->digitsEnd(current, end);
 
     if (peek() == '.' && isDigit(peekNext()))
     {
         advance();
 
-        while (isDigit(peek())) advance();
+        current = kernels->digitsEnd(current, end);
     }
 
     return makeToken(TOKEN_NUMBER);
@@ -159,54 +148,10 @@ Token Scanner::number()
 
 Token Scanner::identifier()
 {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
+    current = kernels->identifierEnd(current, end);
     return makeToken(identifierType());
 }
 
 TokenType Scanner::identifierType() const {
-    switch (start[0])
-    {
-    case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-    case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-    case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-    case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-    case 'f':
-        if (current - start > 1)
-        {
-            switch (start[1])
-            {
-            case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-            case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-            case 'n': return checkKeyword(2, 1, "n", TOKEN_FUN);
-            }
-        }
-        break;
-    case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-    case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-    case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-    case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-    case 't':
-        if (current - start > 1)
-        {
-            switch (start[1])
-            {
-            case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-            case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-            }
-        }
-    case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-    case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
-    }
-    return TOKEN_IDENTIFIER;
-}
-
-TokenType Scanner::checkKeyword(const int s, const int length, const char* rest, const TokenType type) const
-{
-    if (current - start == s + length && memcmp(start + s, rest, length) == 0)
-    {
-        return type;
-    }
-
-    return TOKEN_IDENTIFIER;
+    return keywordType(start, current - start);
 }
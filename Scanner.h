@@ -3,6 +3,7 @@
 #include <cstdint>
 
 #include "Source.h"
+#include "ScannerKernels.h"
 
 enum TokenType: std::uint8_t
 {
@@ -40,13 +41,16 @@ class Scanner
 public:
     const char* start;
     const char* current;
+    const char* end;
     int line;
 
     Scanner() = default;
-    explicit Scanner(const Source& source);
+    explicit Scanner(const Source& source, ScanKernel kernel = bestScanKernel());
     Token nextToken();
 
 private:
+    const ScanKernels* kernels = nullptr;
+
     static bool isDigit(char c);
     static bool isAlpha(char c);
 
@@ -62,5 +66,4 @@ private:
     Token number();
     Token identifier();
     TokenType identifierType() const;
-    TokenType checkKeyword(int start, int length, const char* rest, TokenType type) const;
 };
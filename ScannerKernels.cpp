@@ -0,0 +1,344 @@
+#include "ScannerKernels.h"
+
+#include "CharClass.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CLOXX_HAS_X86_SIMD
+#endif
+
+static bool isWhitespace(const char c)
+{
+    return hasCharClass(c, CHAR_WHITESPACE);
+}
+
+static bool isDigit(const char c)
+{
+    return hasCharClass(c, CHAR_DIGIT);
+}
+
+static bool isIdentifierPart(const char c)
+{
+    return hasCharClass(c, CHAR_ALPHA | CHAR_DIGIT);
+}
+
+// Scalar kernels, also used for the tail of the vectorized ones.
+
+static const char* scalarSkipWhitespace(const char* current, const char* end, int* line)
+{
+    while (current < end && isWhitespace(*current))
+    {
+        if (*current == '\n') (*line)++;
+        current++;
+    }
+    return current;
+}
+
+static const char* scalarFindNewline(const char* current, const char* end)
+{
+    while (current < end && *current != '\n') current++;
+    return current;
+}
+
+static const char* scalarIdentifierEnd(const char* current, const char* end)
+{
+    while (current < end && isIdentifierPart(*current)) current++;
+    return current;
+}
+
+static const char* scalarDigitsEnd(const char* current, const char* end)
+{
+    while (current < end && isDigit(*current)) current++;
+    return current;
+}
+
+static const char* scalarFindQuote(const char* current, const char* end, int* line)
+{
+    while (current < end && *current != '"')
+    {
+        if (*current == '\n') (*line)++;
+        current++;
+    }
+    return current;
+}
+
+#ifdef CLOXX_HAS_X86_SIMD
+
+// Each kernel builds a bit mask with one bit per byte of the block, then finds
+// the first byte that ends the run with a count of trailing zeros.
+
+// SSE2 is part of x86-64, so these need no target attribute.
+
+static __m128i inRange16(const __m128i bytes, const char low, const char high)
+{
+    // Unsigned (bytes - low) <= (high - low), with min since SSE2 has no unsigned compare.
+    const __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(static_cast<char>(high - low))), shifted);
+}
+
+static unsigned equalMask16(const __m128i bytes, const char c)
+{
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c))));
+}
+
+static const char* sse2SkipWhitespace(const char* current, const char* end, int* line)
+{
+    if (current < end && !isWhitespace(*current)) return current;
+
+    while (end - current >= 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current));
+        const unsigned newlines = equalMask16(bytes, '\n');
+        const unsigned whitespace = newlines | equalMask16(bytes, ' ') | equalMask16(bytes, '\t') |
+                                    equalMask16(bytes, '\r');
+        if (whitespace != 0xFFFF)
+        {
+            const int length = __builtin_ctz(~whitespace);
+            *line += __builtin_popcount(newlines & ((1u << length) - 1));
+            return current + length;
+        }
+
+        *line += __builtin_popcount(newlines);
+        current += 16;
+    }
+    return scalarSkipWhitespace(current, end, line);
+}
+
+static const char* sse2FindNewline(const char* current, const char* end)
+{
+    while (end - current >= 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current));
+        const unsigned newlines = equalMask16(bytes, '\n');
+        if (newlines != 0) return current + __builtin_ctz(newlines);
+        current += 16;
+    }
+    return scalarFindNewline(current, end);
+}
+
+static const char* sse2IdentifierEnd(const char* current, const char* end)
+{
+    while (end - current >= 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current));
+        // Setting bit 5 folds 'A'-'Z' onto 'a'-'z' and maps no other byte there.
+        const __m128i letters = inRange16(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z');
+        const __m128i part = _mm_or_si128(_mm_or_si128(letters, inRange16(bytes, '0', '9')),
+                                          _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(part));
+        if (mask != 0xFFFF) return current + __builtin_ctz(~mask);
+        current += 16;
+    }
+    return scalarIdentifierEnd(current, end);
+}
+
+static const char* sse2DigitsEnd(const char* current, const char* end)
+{
+    while (end - current >= 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current));
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(inRange16(bytes, '0', '9')));
+        if (mask != 0xFFFF) return current + __builtin_ctz(~mask);
+        current += 16;
+    }
+    return scalarDigitsEnd(current, end);
+}
+
+static const char* sse2FindQuote(const char* current, const char* end, int* line)
+{
+    while (end - current >= 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current));
+        const unsigned newlines = equalMask16(bytes, '\n');
+        const unsigned quotes = equalMask16(bytes, '"');
+        if (quotes != 0)
+        {
+            const int length = __builtin_ctz(quotes);
+            *line += __builtin_popcount(newlines & ((1u << length) - 1));
+            return current + length;
+        }
+
+        *line += __builtin_popcount(newlines);
+        current += 16;
+    }
+    return scalarFindQuote(current, end, line);
+}
+
+// AVX2 kernels are compiled for AVX2 only and selected after a CPUID check.
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static __m256i inRange32(const __m256i bytes, const char low, const char high)
+{
+    const __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(static_cast<char>(high - low))), shifted);
+}
+
+AVX2 static unsigned equalMask32(const __m256i bytes, const char c)
+{
+    return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c))));
+}
+
+// Bits of the bytes before the one at length, length < 32.
+static unsigned lowBits32(const int length)
+{
+    return (1u << length) - 1;
+}
+
+AVX2 static const char* avx2SkipWhitespace(const char* current, const char* end, int* line)
+{
+    if (current < end && !isWhitespace(*current)) return current;
+
+    while (end - current >= 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current));
+        const unsigned newlines = equalMask32(bytes, '\n');
+        const unsigned whitespace = newlines | equalMask32(bytes, ' ') | equalMask32(bytes, '\t') |
+                                    equalMask32(bytes, '\r');
+        if (whitespace != 0xFFFFFFFF)
+        {
+            const int length = __builtin_ctz(~whitespace);
+            *line += __builtin_popcount(newlines & lowBits32(length));
+            return current + length;
+        }
+
+        *line += __builtin_popcount(newlines);
+        current += 32;
+    }
+    return sse2SkipWhitespace(current, end, line);
+}
+
+AVX2 static const char* avx2FindNewline(const char* current, const char* end)
+{
+    while (end - current >= 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current));
+        const unsigned newlines = equalMask32(bytes, '\n');
+        if (newlines != 0) return current + __builtin_ctz(newlines);
+        current += 32;
+    }
+    return sse2FindNewline(current, end);
+}
+
+AVX2 static const char* avx2IdentifierEnd(const char* current, const char* end)
+{
+    while (end - current >= 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current));
+        const __m256i letters = inRange32(_mm256_or_si256(bytes, _mm256_set1_epi8(0x20)), 'a', 'z');
+        const __m256i part = _mm256_or_si256(_mm256_or_si256(letters, inRange32(bytes, '0', '9')),
+                                             _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_')));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(part));
+        if (mask != 0xFFFFFFFF) return current + __builtin_ctz(~mask);
+        current += 32;
+    }
+    return sse2IdentifierEnd(current, end);
+}
+
+AVX2 static const char* avx2DigitsEnd(const char* current, const char* end)
+{
+    while (end - current >= 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(inRange32(bytes, '0', '9')));
+        if (mask != 0xFFFFFFFF) return current + __builtin_ctz(~mask);
+        current += 32;
+    }
+    return sse2DigitsEnd(current, end);
+}
+
+AVX2 static const char* avx2FindQuote(const char* current, const char* end, int* line)
+{
+    while (end - current >= 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current));
+        const unsigned newlines = equalMask32(bytes, '\n');
+        const unsigned quotes = equalMask32(bytes, '"');
+        if (quotes != 0)
+        {
+            const int length = __builtin_ctz(quotes);
+            *line += __builtin_popcount(newlines & lowBits32(length));
+            return current + length;
+        }
+
+        *line += __builtin_popcount(newlines);
+        current += 32;
+    }
+    return sse2FindQuote(current, end, line);
+}
+
+#undef AVX2
+
+#endif
+
+static constexpr ScanKernels scalarKernels =
+{
+    scalarSkipWhitespace,
+    scalarFindNewline,
+    scalarIdentifierEnd,
+    scalarDigitsEnd,
+    scalarFindQuote,
+};
+
+#ifdef CLOXX_HAS_X86_SIMD
+static constexpr ScanKernels sse2Kernels =
+{
+    sse2SkipWhitespace,
+    sse2FindNewline,
+    sse2IdentifierEnd,
+    sse2DigitsEnd,
+    sse2FindQuote,
+};
+
+static constexpr ScanKernels avx2Kernels =
+{
+    avx2SkipWhitespace,
+    avx2FindNewline,
+    avx2IdentifierEnd,
+    avx2DigitsEnd,
+    avx2FindQuote,
+};
+#endif
+
+bool isScanKernelAvailable(const ScanKernel kernel)
+{
+    switch (kernel)
+    {
+    case SCAN_SCALAR:
+        return true;
+#ifdef CLOXX_HAS_X86_SIMD
+    case SCAN_SSE2:
+        return true;
+    case SCAN_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+ScanKernel bestScanKernel()
+{
+    static const ScanKernel best =
+        isScanKernelAvailable(SCAN_AVX2) ? SCAN_AVX2 :
+        isScanKernelAvailable(SCAN_SSE2) ? SCAN_SSE2 :
+        SCAN_SCALAR;
+    return best;
+}
+
+const ScanKernels& getScanKernels(const ScanKernel kernel)
+{
+    if (!isScanKernelAvailable(kernel))
+    {
+        return scalarKernels;
+    }
+
+    switch (kernel)
+    {
+#ifdef CLOXX_HAS_X86_SIMD
+    case SCAN_SSE2: return sse2Kernels;
+    case SCAN_AVX2: return avx2Kernels;
+#endif
+    default:        return scalarKernels;
+    }
+}
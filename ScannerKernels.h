@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// Scanner hot loops, each available as a scalar and as vectorized kernels that
+// classify 16 (SSE2) or 32 (AVX2) bytes per step. Every kernel stops at end and
+// never reads past it, so it works on unterminated sources.
+enum ScanKernel: std::uint8_t
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+};
+
+struct ScanKernels
+{
+    // First byte that is not ' ', '\t', '\r' or '\n'. Adds the newlines skipped to *line.
+    const char* (*skipWhitespace)(const char* current, const char* end, int* line);
+    // First '\n', or end.
+    const char* (*findNewline)(const char* current, const char* end);
+    // First byte that cannot continue an identifier.
+    const char* (*identifierEnd)(const char* current, const char* end);
+    // First byte that is not a digit.
+    const char* (*digitsEnd)(const char* current, const char* end);
+    // First '"', or end. Adds the newlines skipped to *line.
+    const char* (*findQuote)(const char* current, const char* end, int* line);
+};
+
+bool isScanKernelAvailable(ScanKernel kernel);
+ScanKernel bestScanKernel();                            // Picked once from CPUID.
+const ScanKernels& getScanKernels(ScanKernel kernel);   // Unavailable kernels fall back to scalar.
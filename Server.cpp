@@ -0,0 +1,340 @@
+#include "Server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define CLOXX_HAS_UNIX_SOCKETS
+#endif
+
+#include "BytecodeCache.h"
+#include "CompiledChunk.h"
+#include "Value.h"
+#include "VM.h"
+
+bool readLine(std::FILE* in, std::string* line)
+{
+    line->clear();
+    int c;
+    while ((c = std::fgetc(in)) != EOF && c != '\n')
+    {
+        line->push_back(static_cast<char>(c));
+    }
+    if (c == EOF && line->empty())
+    {
+        return false;
+    }
+
+    if (!line->empty() && line->back() == '\r')
+    {
+        line->pop_back();
+    }
+    return true;
+}
+
+RequestStatus readRequest(std::FILE* in, std::string* expression)
+{
+    do
+    {
+        if (!readLine(in, expression))
+        {
+            return REQUEST_END;
+        }
+    } while (expression->empty());
+
+    if ((*expression)[0] != '#')
+    {
+        return REQUEST_OK;
+    }
+
+    // strtoull() alone would also take "#", "# 5" and "#-5".
+    const std::size_t digits = expression->size() - 1;
+    if (digits == 0 || std::strspn(expression->c_str() + 1, "0123456789") != digits)
+    {
+        return REQUEST_MALFORMED;
+    }
+
+    const unsigned long long length = std::strtoull(expression->c_str() + 1, nullptr, 10); // Saturates.
+    if (length > MAX_REQUEST_LENGTH)
+    {
+        return REQUEST_TOO_LONG; // The length comes from the client: never allocate it up front.
+    }
+
+    expression->resize(length);
+    return std::fread(expression->data(), 1, length, in) == length ? REQUEST_OK : REQUEST_END;
+}
+
+std::string requestErrorMessage(const RequestStatus status)
+{
+    if (status == REQUEST_TOO_LONG)
+    {
+        return "Request longer than " + std::to_string(MAX_REQUEST_LENGTH) + " bytes.";
+    }
+    return "Malformed length prefix: expected '#' followed by digits.";
+}
+
+// Keeps the response on one line. A carriage return is escaped too, since
+// readLine() drops one ending the line.
+static void appendEscaped(std::string* response, const std::string_view text)
+{
+    for (const char c : text)
+    {
+        switch (c)
+        {
+        case '\n':  *response += "\\n"; break;
+        case '\r':  *response += "\\r"; break;
+        case '\\':  *response += "\\\\"; break;
+        default:    *response += c; break;
+        }
+    }
+}
+
+// Without the newline that ends the last message.
+static void appendDiagnostics(std::string* response, const std::string& text)
+{
+    std::size_t end = text.size();
+    while (end > 0 && text[end - 1] == '\n')
+    {
+        end--;
+    }
+    appendEscaped(response, std::string_view(text).substr(0, end));
+}
+
+const CompiledChunk& EvalServer::compileCached(const std::string& expression)
+{
+    const std::uint64_t hash = hashSource(expression.data(), expression.size());
+    const auto cached = cache.find(hash);
+    if (cached != cache.end() && cached->second.source == expression)
+    {
+        return cached->second.chunk;
+    }
+
+    // A colliding expression drops the cache too, so that the strings of the
+    // chunk it would replace are not kept past it.
+    if (cache.size() >= MAX_CACHED_CHUNKS || cached != cache.end())
+    {
+        cache.clear();
+        cachedStrings.clear();
+        vm.setExtraRoots({});
+        vm.collectGarbage(); // Frees the strings of the dropped chunks that no global holds.
+    }
+
+    CompilerOptions options;
+    options.heap = vm.stringHeap();
+    CachedChunk& entry = cache[hash];
+    entry.source = expression;
+    entry.chunk = compile(expression, options);
+
+    const ChunkView view = entry.chunk.view();
+    for (const std::span<const Value> values : {view.constants, view.globals})
+    {
+        std::copy_if(values.begin(), values.end(), std::back_inserter(cachedStrings),
+                     [](const Value& value) { return IS_OBJ_STRING(value); });
+    }
+    vm.setExtraRoots(cachedStrings);
+    return entry.chunk;
+}
+
+std::string EvalServer::evaluate(const std::string& expression)
+{
+    const CompiledChunk& chunk = compileCached(expression);
+    if (!chunk.isValid())
+    {
+        std::string response = "compile_error\t";
+        appendDiagnostics(&response, chunk.errors());
+        return response;
+    }
+
+    runtimeErrors.clear();
+    vm.setErrorOutput(&runtimeErrors);
+    const InterpretResult result = vm.run(chunk);
+    vm.setErrorOutput(nullptr);
+
+    if (result != INTERPRET_OK)
+    {
+        std::string response = "runtime_error\t";
+        appendDiagnostics(&response, runtimeErrors);
+        return response;
+    }
+    std::string response = "ok\t";
+    appendEscaped(&response, formatValue(vm.lastResult())); // String values may hold newlines.
+    return response;
+}
+
+void EvalServer::serve(std::FILE* in, std::FILE* out)
+{
+    vm.resetGlobals();
+    std::string expression;
+    while (!stopping)
+    {
+        const RequestStatus status = readRequest(in, &expression);
+        if (status == REQUEST_END)
+        {
+            return;
+        }
+
+        const std::string response = status == REQUEST_OK ? evaluate(expression)
+                                                          : "request_error\t" + requestErrorMessage(status);
+        if (std::fwrite(response.data(), 1, response.size(), out) != response.size() ||
+            std::fputc('\n', out) == EOF || std::fflush(out) != 0)
+        {
+            return; // The client went away.
+        }
+        if (status != REQUEST_OK)
+        {
+            return;
+        }
+    }
+}
+
+bool EvalServer::serveSocket(const char* path)
+{
+#ifdef CLOXX_HAS_UNIX_SOCKETS
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof(address.sun_path))
+    {
+        errorMessage = std::string("Socket path \"") + path + "\" is too long.";
+        return false;
+    }
+    std::strcpy(address.sun_path, path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        errorMessage = std::string("Could not create a socket: ") + std::strerror(errno);
+        return false;
+    }
+
+    // A client closing before it reads its responses must only end its own
+    // connection: writing to it then fails with EPIPE instead of raising SIGPIPE.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    unlink(path); // A socket file left by an earlier server.
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, 16) < 0)
+    {
+        errorMessage = std::string("Could not listen on \"") + path + "\": " + std::strerror(errno);
+        ::close(listener);
+        listener = -1;
+        return false;
+    }
+
+    while (!stopping)
+    {
+        const int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        std::FILE* in = fdopen(connection, "r");
+        std::FILE* out = fdopen(dup(connection), "w");
+        if (in != nullptr && out != nullptr)
+        {
+            serve(in, out);
+        }
+        if (in != nullptr) std::fclose(in); else ::close(connection);
+        if (out != nullptr) std::fclose(out);
+    }
+
+    ::close(listener);
+    listener = -1;
+    unlink(path);
+    return true;
+#else
+    errorMessage = "Unix domain sockets are not supported on this platform.";
+    return false;
+#endif
+}
+
+// Safe to call from another thread: shutting the listener down wakes accept().
+void EvalServer::stop()
+{
+    stopping = true;
+#ifdef CLOXX_HAS_UNIX_SOCKETS
+    if (listener >= 0)
+    {
+        shutdown(listener, SHUT_RDWR);
+    }
+#endif
+}
+
+EvalClient::~EvalClient()
+{
+    close();
+}
+
+bool EvalClient::connect(const char* path)
+{
+    close();
+
+#ifdef CLOXX_HAS_UNIX_SOCKETS
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof(address.sun_path))
+    {
+        errorMessage = std::string("Socket path \"") + path + "\" is too long.";
+        return false;
+    }
+    std::strcpy(address.sun_path, path);
+
+    const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || ::connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        errorMessage = std::string("Could not connect to \"") + path + "\": " + std::strerror(errno);
+        if (connection >= 0) ::close(connection);
+        return false;
+    }
+
+    in = fdopen(connection, "r");
+    out = fdopen(dup(connection), "w");
+    if (in == nullptr || out == nullptr)
+    {
+        errorMessage = std::string("Could not open the connection: ") + std::strerror(errno);
+        if (in == nullptr) ::close(connection);
+        close();
+        return false;
+    }
+    return true;
+#else
+    errorMessage = "Unix domain sockets are not supported on this platform.";
+    return false;
+#endif
+}
+
+// Always length-prefixed, so expressions may hold newlines.
+bool EvalClient::send(const std::string& expression)
+{
+    return out != nullptr && std::fprintf(out, "#%zu\n", expression.size()) > 0 &&
+           std::fwrite(expression.data(), 1, expression.size(), out) == expression.size();
+}
+
+bool EvalClient::receive(std::string* response)
+{
+    return in != nullptr && std::fflush(out) == 0 && readLine(in, response);
+}
+
+bool EvalClient::evaluate(const std::string& expression, std::string* response)
+{
+    return send(expression) && receive(response);
+}
+
+void EvalClient::close()
+{
+    if (in != nullptr) std::fclose(in);
+    if (out != nullptr) std::fclose(out);
+    in = nullptr;
+    out = nullptr;
+}
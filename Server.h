@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CompiledChunk.h"
+#include "VM.h"
+
+// Evaluation server: a long-lived process that compiles and runs expressions on
+// one warm VM, keeping the chunks it compiled. The VM quickens them as they run.
+// Their long strings belong to the heap of the VM, so that they are freed once
+// the cache is dropped, unless a global variable or the last result holds them.
+//
+// Each request is either one line holding an expression, or "#<length>" on a
+// line of its own followed by exactly length bytes, for expressions spanning
+// several lines, up to MAX_REQUEST_LENGTH. Empty lines are skipped. Each
+// response is one line, in request order:
+//
+//     ok<TAB><value>
+//     compile_error<TAB><diagnostics>
+//     runtime_error<TAB><diagnostics>
+//     request_error<TAB><message>
+//
+// with newlines in values and diagnostics written as "\n", carriage returns as
+// "\r" and backslashes as "\\", so that a string value spans one line.
+// A request_error answers a length prefix that is longer, or that is not '#'
+// followed by digits; the server then ends the stream, since it cannot tell
+// where the next request starts.
+// Globals defined by a request are seen by the later requests of the same
+// stream, so a client can set up configuration once and then send rules.
+class EvalServer
+{
+public:
+    static constexpr std::size_t MAX_CACHED_CHUNKS = 4096; // The cache is dropped when full.
+
+    EvalServer() { vm.setQuickening(true); }
+
+    EvalServer(const EvalServer&) = delete;
+    EvalServer& operator=(const EvalServer&) = delete;
+
+    // Answers the requests read from in until it ends, or until a response
+    // cannot be written.
+    void serve(std::FILE* in, std::FILE* out);
+
+    // Listens on a Unix domain socket and serves one connection at a time until
+    // stop() is called. Returns false, with error() set, if the socket cannot be
+    // created. Ignores SIGPIPE for the whole process, so that a client
+    // disconnecting early only ends its connection.
+    bool serveSocket(const char* path);
+    void stop();
+
+    std::string evaluate(const std::string& expression);
+
+    // Cached chunks run as machine code once hot, see VM::setJit().
+    void setJit(const bool enabled) { vm.setJit(enabled); }
+
+    // Profiles every evaluation, see VM::setProfiler().
+    void setProfiler(Profiler* profiler) { vm.setProfiler(profiler); }
+    const std::string& error() const { return errorMessage; }
+
+private:
+    struct CachedChunk
+    {
+        std::string source;
+        CompiledChunk chunk;
+    };
+
+    VM vm;
+    std::unordered_map<std::uint64_t, CachedChunk> cache; // By hashSource() of the expression.
+    std::vector<Value> cachedStrings; // Long strings of the cached chunks, owned by vm: its extra roots.
+    std::string runtimeErrors;
+    int listener = -1;
+    std::atomic<bool> stopping = false;
+    std::string errorMessage;
+
+    const CompiledChunk& compileCached(const std::string& expression);
+};
+
+// Client side of the protocol, over a Unix domain socket.
+class EvalClient
+{
+public:
+    EvalClient() = default;
+    ~EvalClient();
+
+    EvalClient(const EvalClient&) = delete;
+    EvalClient& operator=(const EvalClient&) = delete;
+
+    bool connect(const char* path);
+
+    // send() only buffers the request; receive() flushes, then reads the
+    // response line without its newline. Several requests can be sent before
+    // reading their responses.
+    bool send(const std::string& expression);
+    bool receive(std::string* response);
+    bool evaluate(const std::string& expression, std::string* response);
+
+    const std::string& error() const { return errorMessage; }
+
+private:
+    std::FILE* in = nullptr;
+    std::FILE* out = nullptr;
+    std::string errorMessage;
+
+    void close();
+};
+
+constexpr std::size_t MAX_REQUEST_LENGTH = 16 * 1024 * 1024;
+
+enum RequestStatus
+{
+    REQUEST_OK,
+    REQUEST_TOO_LONG,   // Its length prefix exceeds MAX_REQUEST_LENGTH; nothing past it was read.
+    REQUEST_MALFORMED,  // A line starting with '#' is not a length prefix; nothing past it was read.
+    REQUEST_END,        // End of in.
+};
+
+// Reads one request, as described above, into expression.
+RequestStatus readRequest(std::FILE* in, std::string* expression);
+// Message of the request_error answering a request that failed to read.
+std::string requestErrorMessage(RequestStatus status);
+// Reads one line without its newline. False at the end of in.
+bool readLine(std::FILE* in, std::string* line);
@@ -1,39 +1,163 @@
 #include "Source.h"
 
-#include <cstdlib>
-#include <fstream>
-#include <iostream>
-#include <memory>
+#include <cstdio>
+#include <string>
 
-Source::Source(const char* path)
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CLOXX_HAS_MMAP
+#endif
+
+Source::Source(const std::string& contents)
+    : buffer(contents.begin(), contents.end())
+    , text(buffer.empty() ? "" : buffer.data())
+    , length(buffer.size())
+{
+}
+
+Source::~Source()
+{
+    release();
+}
+
+bool Source::openFile(const char* path)
 {
-    std::ifstream file(path, std::ios::in | std::ios::ate);
+    release();
+
+#ifdef CLOXX_HAS_MMAP
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return fail("Failed to open file \"" + std::string(path) + "\".");
+    }
+
+    struct stat info{};
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return fail("Failed to read file \"" + std::string(path) + "\".");
+    }
+
+    // Only regular files can be mapped, everything else is streamed.
+    if (!S_ISREG(info.st_mode))
+    {
+        std::FILE* stream = fdopen(fd, "rb");
+        if (stream == nullptr)
+        {
+            close(fd);
+            return fail("Failed to open file \"" + std::string(path) + "\".");
+        }
+
+        const bool ok = readStream(stream, path);
+        std::fclose(stream);
+        return ok;
+    }
+
+    length = static_cast<std::size_t>(info.st_size);
+    if (length == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+    {
+        length = 0;
+        return fail("Failed to map file \"" + std::string(path) + "\".");
+    }
 
-    if (!file.is_open())
+    madvise(address, length, MADV_SEQUENTIAL);
+    mapping = address;
+    mappingSize = length;
+    text = static_cast<const char*>(address);
+    return true;
+#else
+    std::FILE* stream = std::fopen(path, "rb");
+    if (stream == nullptr)
     {
-        std::cerr << "Failed to open file \"" << path << "\"." << std::endl;
-        std::exit(74);
+        return fail("Failed to open file \"" + std::string(path) + "\".");
     }
 
-    const std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    const bool ok = readStream(stream, path);
+    std::fclose(stream);
+    return ok;
+#endif
+}
+
+bool Source::readStream(std::FILE* stream, const char* name)
+{
+    release();
+
+    constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+    std::size_t used = 0;
+    for (;;)
+    {
+        buffer.resize(used + BLOCK_SIZE);
+        const std::size_t read = std::fread(buffer.data() + used, 1, BLOCK_SIZE, stream);
+        used += read;
+
+        if (read < BLOCK_SIZE)
+        {
+            break;
+        }
+    }
 
-    buffer = std::make_unique<char[]>(size + 1);
-    if (buffer == nullptr) {
-        std::cerr << "Failed to allocate buffer." << std::endl;
-        std::exit(74);
+    if (std::ferror(stream))
+    {
+        buffer.clear();
+        return fail("Failed to read file \"" + std::string(name) + "\".");
     }
 
-    if (!file.read(buffer.get(), size))
+    buffer.resize(used);
+    text = buffer.empty() ? "" : buffer.data();
+    length = used;
+    return true;
+}
+
+const char* Source::operator[](const std::size_t idx) const
+{
+    return text + idx;
+}
+
+const char* Source::end() const
+{
+    return text + length;
+}
+
+std::size_t Source::size() const
+{
+    return length;
+}
+
+const std::string& Source::error() const
+{
+    return errorMessage;
+}
+
+void Source::release()
+{
+#ifdef CLOXX_HAS_MMAP
+    if (mapping != nullptr)
     {
-        std::cerr << "Failed to read file \"" << path << "\"." << std::endl;
-        std::exit(74);
+        munmap(mapping, mappingSize);
     }
+#endif
 
-    buffer[size] = '\0';
+    mapping = nullptr;
+    mappingSize = 0;
+    buffer.clear();
+    text = "";
+    length = 0;
+    errorMessage.clear();
 }
 
-char* Source::operator[](const std::size_t idx) const
+bool Source::fail(const std::string& message)
 {
-    return buffer.get() + idx;
+    errorMessage = message;
+    return false;
 }
\ No newline at end of file
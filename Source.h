@@ -1,15 +1,39 @@
 #pragma once
 
 #include <cstddef>
-#include <memory>
+#include <cstdio>
+#include <string>
+#include <vector>
 
+// Script text handed to the Scanner. Regular files are memory-mapped and used
+// in place; pipes, terminals and stdin are read through a buffer. The text is
+// not NUL-terminated, the Scanner stops at end().
 class Source
 {
 public:
-    explicit Source(const char* path);
+    Source() = default;
+    explicit Source(const std::string& contents);
+    ~Source();
 
-    char* operator[](std::size_t idx) const;
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+
+    bool openFile(const char* path);
+    bool readStream(std::FILE* stream, const char* name);
+
+    const char* operator[](std::size_t idx) const;
+    const char* end() const;
+    std::size_t size() const;
+    const std::string& error() const;
 
 private:
-    std::unique_ptr<char[]> buffer;
+    void* mapping = nullptr;
+    std::size_t mappingSize = 0;
+    std::vector<char> buffer;
+    const char* text = "";
+    std::size_t length = 0;
+    std::string errorMessage;
+
+    void release();
+    bool fail(const std::string& message);
 };
\ No newline at end of file
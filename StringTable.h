@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Object.h"
+
+class Heap;
+
+// Storage of one or more strings, each a prefix of the next: appending to the
+// longest one writes past used. Bytes below used never change, so strings are
+// read without any lock.
+struct StringBuffer
+{
+    std::unique_ptr<char[]> chars;
+    std::size_t capacity;
+    std::size_t used;
+    Heap* owner = nullptr;          // Null for the process-wide table, whose buffers are never freed.
+    std::uint32_t strings = 0;      // Strings of owner using these chars; freed with the last one.
+};
+
+// Open addressing with linear probing. Entries cache the hash of their string
+// so that probing only follows the pointer of a likely match. Removal shifts
+// the rest of the cluster back, so there are no tombstones.
+class StringTable
+{
+public:
+    // The interned string made of head followed by tail, if any.
+    ObjString* find(const std::uint32_t hash, const std::string_view head, const std::string_view tail) const
+    {
+        if (entries.empty())
+        {
+            return nullptr;
+        }
+
+        const std::size_t length = head.size() + tail.size();
+        for (std::size_t index = hash & mask();; index = (index + 1) & mask())
+        {
+            const Entry& entry = entries[index];
+            if (entry.string == nullptr)
+            {
+                return nullptr;
+            }
+
+            const ObjString* string = entry.string;
+            // A string built on head shares its characters, so only the tail needs comparing.
+            if (entry.hash == hash && string->length == length &&
+                (string->chars == head.data() || std::memcmp(string->chars, head.data(), head.size()) == 0) &&
+                std::memcmp(string->chars + head.size(), tail.data(), tail.size()) == 0)
+            {
+                return entry.string;
+            }
+        }
+    }
+
+    void insert(ObjString* string)
+    {
+        if ((count + 1) * 4 > entries.size() * 3)
+        {
+            grow();
+        }
+
+        for (std::size_t index = string->hash & mask();; index = (index + 1) & mask())
+        {
+            if (entries[index].string == nullptr)
+            {
+                entries[index] = Entry{string->hash, string};
+                count++;
+                return;
+            }
+        }
+    }
+
+    // Removes string, which must be in the table.
+    void remove(const ObjString* string)
+    {
+        std::size_t hole = string->hash & mask();
+        while (entries[hole].string != string)
+        {
+            hole = (hole + 1) & mask();
+        }
+
+        // An entry may fill the hole unless its home slot lies between the hole and itself.
+        for (std::size_t index = (hole + 1) & mask(); entries[index].string != nullptr; index = (index + 1) & mask())
+        {
+            const std::size_t home = entries[index].hash & mask();
+            if (((index - home) & mask()) >= ((index - hole) & mask()))
+            {
+                entries[hole] = entries[index];
+                hole = index;
+            }
+        }
+        entries[hole] = Entry{};
+        count--;
+    }
+
+private:
+    struct Entry
+    {
+        std::uint32_t hash = 0;
+        ObjString* string = nullptr;
+    };
+
+    std::vector<Entry> entries; // Power of two in size.
+    std::size_t count = 0;
+
+    std::size_t mask() const { return entries.size() - 1; }
+
+    void grow()
+    {
+        std::vector<Entry> old = std::move(entries);
+        entries.assign(std::max<std::size_t>(64, old.size() * 2), Entry{});
+        count = 0;
+        for (const Entry& entry : old)
+        {
+            if (entry.string != nullptr)
+            {
+                insert(entry.string);
+            }
+        }
+    }
+};
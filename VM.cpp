@@ -1,150 +1,519 @@
 #include "VM.h"
 
+#include <chrono>
+#include <cstdarg>
 #include <cstdio>
 #include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
 
 #include "Debug.h"
 #include "Compiler.h"
+#include "CompiledChunk.h"
 #include "Source.h"
 #include "Value.h"
 #include "Chunk.h"
 #include "Common.h"
+#include "Jit.h"
+#include "Object.h"
+#include "Profiler.h"
 
 VM::VM()
+    : resultValue(NIL_VAL)
+    , engine(CLOXX_DEFAULT_DISPATCH)
 {
     resetStack();
 }
 
 InterpretResult VM::interpret(const Source& source)
 {
+    compileArena.reset(Compiler::arenaBytes(source.size()));
+
     Compiler compiler;
-    chunk = new Chunk();
-    if (!compiler.compile(source, chunk))
+    Chunk compiled(compileArena.resource());
+    if (!compiler.compile(source, &compiled))
     {
-        free(chunk);
         return INTERPRET_COMPILE_ERROR;
     }
 
-    ip = chunk->code.data();
+    return interpret(compiled);
+}
 
-    const InterpretResult result = run();
+InterpretResult VM::interpret(const Chunk& c)
+{
+    return interpret(c.view());
+}
+
+InterpretResult VM::run(const CompiledChunk& c)
+{
+    if (!c.isValid())
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    if (useJit())
+    {
+        if (const JitCode* code = c.hotJitCode())
+        {
+            chunk = c.view();
+            return runJit(*code);
+        }
+    }
 
-    free(chunk);
+    chunk = quickening ? quickenedView(c) : c.view();
+    globalSlots = chunk.globals.empty() ? nullptr : resolvedGlobals(c);
+    ip = chunk.code.data();
+    resetStack();
+    const InterpretResult result = run();
+    quickCode = nullptr;
     return result;
 }
 
+void VM::setQuickening(const bool enabled)
+{
+    quickening = enabled;
+    if (!enabled)
+    {
+        quickened.clear();
+    }
+}
+
+// Quickened code is only ever written by this VM, and keeps the line table and
+// constants of the original.
+ChunkView VM::quickenedView(const CompiledChunk& c)
+{
+    const ChunkView original = c.view();
+    auto found = quickened.find(original.code.data());
+    if (found == quickened.end())
+    {
+        if (quickened.size() >= MAX_QUICKENED_CHUNKS)
+        {
+            quickened.clear();
+        }
+        QuickenedCode copy{c, std::vector<std::uint8_t>(original.code.begin(), original.code.end())};
+        found = quickened.emplace(original.code.data(), std::move(copy)).first;
+    }
+
+    quickCode = found->second.code.data();
+    return ChunkView{found->second.code, original.lines, original.constants, original.globals};
+}
+
+void VM::resetGlobals()
+{
+    globals.clear();
+    globalIndex.clear();
+    resolved.clear();
+}
+
+const std::uint32_t* VM::resolvedGlobals(const CompiledChunk& c)
+{
+    const ChunkView original = c.view();
+    auto found = resolved.find(original.code.data());
+    if (found == resolved.end())
+    {
+        if (resolved.size() >= MAX_RESOLVED_CHUNKS)
+        {
+            resolved.clear();
+        }
+        found = resolved.emplace(original.code.data(), ResolvedGlobals{c, {}}).first;
+        resolveGlobals(original.globals, &found->second.slots);
+    }
+    return found->second.slots.data();
+}
+
+// The one lookup by name of each global of a chunk: instructions then index
+// globals through slots.
+void VM::resolveGlobals(const std::span<const Value> names, std::vector<std::uint32_t>* slots)
+{
+    slots->resize(names.size());
+    for (std::size_t i = 0; i < names.size(); i++)
+    {
+        const auto [entry, added] = globalIndex.try_emplace(names[i], static_cast<std::uint32_t>(globals.size()));
+        if (added)
+        {
+            globals.push_back(Global{NIL_VAL, false, names[i]});
+        }
+        (*slots)[i] = entry->second;
+    }
+}
+
+InterpretResult VM::interpret(const ChunkView& c)
+{
+    chunk = c;
+    if (useJit())
+    {
+        if (const std::unique_ptr<JitCode> code = JitCode::compile(c))
+        {
+            return runJit(*code);
+        }
+    }
+
+    resolveGlobals(chunk.globals, &viewGlobalSlots);
+    globalSlots = viewGlobalSlots.data();
+    ip = chunk.code.data();
+    resetStack();
+    return run();
+}
+
+// A failed operand check leaves the stack as it was before the instruction, so
+// the interpreter resumes there and reports the error from its own check.
+InterpretResult VM::runJit(const JitCode& code)
+{
+    const JitExit& exit = code.run(stack.data());
+    stackTop = stack.data() + exit.depth;
+    if (exit.returned)
+    {
+        resultValue = pop();
+        heap.writeBarrier(resultValue);
+        return INTERPRET_OK;
+    }
+
+    ip = chunk.code.data() + exit.offset;
+    return run();
+}
+
+bool VM::isDispatchEngineAvailable(const DispatchEngine engine)
+{
+    switch (engine)
+    {
+    case DISPATCH_SWITCH:
+        return true;
+    case DISPATCH_COMPUTED_GOTO:
+#ifdef CLOXX_HAS_COMPUTED_GOTO
+        return true;
+#else
+        return false;
+#endif
+    case DISPATCH_TAIL_CALL:
+#ifdef CLOXX_HAS_MUSTTAIL
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return false;
+    }
+}
+
+void VM::setDispatchEngine(const DispatchEngine e)
+{
+    // Engines the compiler cannot build fall back to the portable switch loop.
+    engine = isDispatchEngineAvailable(e) ? e : DISPATCH_SWITCH;
+}
+
+InterpretResult VM::run()
+{
+    if (profiler != nullptr)
+    {
+        profiler->begin(chunk);
+        const InterpretResult result = run<RUN_PROFILE>();
+        profiler->end();
+        return result;
+    }
+
+    return trace ? run<RUN_TRACE>() : run<RUN_PLAIN>();
+}
+
+template <RunMode Mode>
 InterpretResult VM::run()
 {
-#define BINARY_OP(valueType, op) \
+    switch (engine)
+    {
+    case DISPATCH_COMPUTED_GOTO:    return runComputedGoto<Mode>();
+    case DISPATCH_TAIL_CALL:        return runTailCall<Mode>();
+    default:                        return runSwitch<Mode>();
+    }
+}
+
+#define BINARY_OP(valueType, op, quick) \
     do { \
       if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {\
         runtimeError("Operands must be numbers"); \
         return INTERPRET_RUNTIME_ERROR; \
       } \
+      quicken(quick); \
       const double b = AS_NUMBER(pop()); \
       const double a = AS_NUMBER(pop()); \
       push(valueType(a op b)); \
     } while (false)
 
+// Body of a BINARY_OP whose operands are known to be numbers.
+#define BINARY_NUM_OP(valueType, op) \
+    do { \
+      const double b = AS_NUMBER(stackTop[-1]); \
+      const double a = AS_NUMBER(stackTop[-2]); \
+      stackTop[-2] = valueType(a op b); \
+      stackTop--; \
+    } while (false)
+
+// Fused comparisons negate the inverse test, like the OP_NOT they replace, so
+// that NaN operands give the same result as the unfused sequence.
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+// Resolved at compile time, RUN_PLAIN instantiations contain no instrumentation.
+#define INSTRUMENT(mode) \
+    do { \
+      if constexpr ((mode) == RUN_TRACE) traceExecution(); \
+      else if constexpr ((mode) == RUN_PROFILE) profileExecution(); \
+    } while (false)
+
+template <RunMode Mode>
+InterpretResult VM::runSwitch()
+{
+#define HANDLER(op) case op:
+#define DISPATCH() continue
+
     for (;;)
     {
-    #ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (const Value* slot = stack.data(); slot < stackTop; slot++)
-        {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-        disassembleInstruction(*chunk, static_cast<int>(ip - chunk->code.data()));
-    #endif
+        INSTRUMENT(Mode);
 
         const std::uint8_t instruction = readByte();
         switch (instruction)
         {
-        case OP_CONSTANT:
-        {
-            const Value constant = readConstant();
-            push(constant);
-            break;
-        }
-        case OP_NIL: push(NIL_VAL); break;
-        case OP_TRUE: push(BOOL_VAL(true)); break;
-        case OP_FALSE: push(BOOL_VAL(false)); break;
-        case OP_EQUAL: {
-            const Value b = pop();
-            const Value a = pop();
-            push(BOOL_VAL(valuesEqual(a, b)));
-            break;
-        }
-        case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-        case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
-        case OP_ADD:      BINARY_OP(NUMBER_VAL, +); break;
-        case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-        case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-        case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
-        case OP_NOT:
-            push(BOOL_VAL(isFalsey(pop())));
-            break;
-        case OP_NEGATE:
-            if (!IS_NUMBER(peek(0)))
-            {
-                runtimeError("Operand must be a number.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(NUMBER_VAL(-AS_NUMBER(pop())));
-            break;
-        case OP_RETURN:
-        {
-            printValue(pop());
-            printf("\n");
-            return INTERPRET_OK;
-        }
+#include "VMHandlers.inc"
             default: ;
         }
     }
 
-    return InterpretResult::INTERPRET_RUNTIME_ERROR;
-
-#undef BINARY_OP
+#undef HANDLER
+#undef DISPATCH
 }
 
-inline std::uint8_t VM::readByte()
+template <RunMode Mode>
+InterpretResult VM::runComputedGoto()
 {
-    return *ip++;
+#ifdef CLOXX_HAS_COMPUTED_GOTO
+#define HANDLER(op) label_##op:
+#define DISPATCH() \
+    do { \
+      INSTRUMENT(Mode); \
+      goto *labels[readByte()]; \
+    } while (false)
+
+    // Indexed by opcode, must follow the declaration order of OpCode.
+    static void* const labels[] =
+    {
+        &&label_OP_CONSTANT,
+        &&label_OP_CONSTANT_LONG,
+        &&label_OP_NIL,
+        &&label_OP_TRUE,
+        &&label_OP_FALSE,
+        &&label_OP_INPUT,
+        &&label_OP_POP,
+        &&label_OP_DEFINE_GLOBAL_SLOT,
+        &&label_OP_GET_GLOBAL_SLOT,
+        &&label_OP_SET_GLOBAL_SLOT,
+        &&label_OP_EQUAL,
+        &&label_OP_NOT_EQUAL,
+        &&label_OP_GREATER,
+        &&label_OP_GREATER_EQUAL,
+        &&label_OP_LESS,
+        &&label_OP_LESS_EQUAL,
+        &&label_OP_ADD,
+        &&label_OP_SUBTRACT,
+        &&label_OP_MULTIPLY,
+        &&label_OP_DIVIDE,
+        &&label_OP_NOT,
+        &&label_OP_NEGATE,
+        &&label_OP_RETURN,
+        &&label_OP_GREATER_UNCHECKED,
+        &&label_OP_GREATER_EQUAL_UNCHECKED,
+        &&label_OP_LESS_UNCHECKED,
+        &&label_OP_LESS_EQUAL_UNCHECKED,
+        &&label_OP_ADD_UNCHECKED,
+        &&label_OP_SUBTRACT_UNCHECKED,
+        &&label_OP_MULTIPLY_UNCHECKED,
+        &&label_OP_DIVIDE_UNCHECKED,
+        &&label_OP_NEGATE_UNCHECKED,
+        &&label_OP_GREATER_NUM,
+        &&label_OP_GREATER_EQUAL_NUM,
+        &&label_OP_LESS_NUM,
+        &&label_OP_LESS_EQUAL_NUM,
+        &&label_OP_ADD_NUM,
+        &&label_OP_SUBTRACT_NUM,
+        &&label_OP_MULTIPLY_NUM,
+        &&label_OP_DIVIDE_NUM,
+        &&label_OP_NEGATE_NUM,
+    };
+    static_assert(std::size(labels) == OP_COUNT, "Every opcode needs a label.");
+
+    DISPATCH();
+
+#include "VMHandlers.inc"
+
+#undef HANDLER
+#undef DISPATCH
+#else
+    return runSwitch<Mode>();
+#endif
 }
 
-inline Value VM::readConstant()
+#ifdef CLOXX_HAS_MUSTTAIL
+// Function templates cannot be partially specialized, so the handlers are
+// included once per value of TAIL_MODE.
+#define HANDLER(op) template <> InterpretResult VM::tailHandler<op, TAIL_MODE>()
+#define DISPATCH() \
+    { \
+      INSTRUMENT(TAIL_MODE); \
+      [[clang::musttail]] return (this->*tailHandlers<TAIL_MODE>[readByte()])(); \
+    }
+
+// Indexed by opcode, must follow the declaration order of OpCode.
+#define TAIL_HANDLER_TABLE(mode) \
+    template <> const std::array<VM::TailHandler, OP_COUNT> VM::tailHandlers<mode> = \
+    { \
+        &VM::tailHandler<OP_CONSTANT, mode>, \
+        &VM::tailHandler<OP_CONSTANT_LONG, mode>, \
+        &VM::tailHandler<OP_NIL, mode>, \
+        &VM::tailHandler<OP_TRUE, mode>, \
+        &VM::tailHandler<OP_FALSE, mode>, \
+        &VM::tailHandler<OP_INPUT, mode>, \
+        &VM::tailHandler<OP_POP, mode>, \
+        &VM::tailHandler<OP_DEFINE_GLOBAL_SLOT, mode>, \
+        &VM::tailHandler<OP_GET_GLOBAL_SLOT, mode>, \
+        &VM::tailHandler<OP_SET_GLOBAL_SLOT, mode>, \
+        &VM::tailHandler<OP_EQUAL, mode>, \
+        &VM::tailHandler<OP_NOT_EQUAL, mode>, \
+        &VM::tailHandler<OP_GREATER, mode>, \
+        &VM::tailHandler<OP_GREATER_EQUAL, mode>, \
+        &VM::tailHandler<OP_LESS, mode>, \
+        &VM::tailHandler<OP_LESS_EQUAL, mode>, \
+        &VM::tailHandler<OP_ADD, mode>, \
+        &VM::tailHandler<OP_SUBTRACT, mode>, \
+        &VM::tailHandler<OP_MULTIPLY, mode>, \
+        &VM::tailHandler<OP_DIVIDE, mode>, \
+        &VM::tailHandler<OP_NOT, mode>, \
+        &VM::tailHandler<OP_NEGATE, mode>, \
+        &VM::tailHandler<OP_RETURN, mode>, \
+        &VM::tailHandler<OP_GREATER_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_GREATER_EQUAL_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_LESS_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_LESS_EQUAL_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_ADD_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_SUBTRACT_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_MULTIPLY_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_DIVIDE_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_NEGATE_UNCHECKED, mode>, \
+        &VM::tailHandler<OP_GREATER_NUM, mode>, \
+        &VM::tailHandler<OP_GREATER_EQUAL_NUM, mode>, \
+        &VM::tailHandler<OP_LESS_NUM, mode>, \
+        &VM::tailHandler<OP_LESS_EQUAL_NUM, mode>, \
+        &VM::tailHandler<OP_ADD_NUM, mode>, \
+        &VM::tailHandler<OP_SUBTRACT_NUM, mode>, \
+        &VM::tailHandler<OP_MULTIPLY_NUM, mode>, \
+        &VM::tailHandler<OP_DIVIDE_NUM, mode>, \
+        &VM::tailHandler<OP_NEGATE_NUM, mode>, \
+    }
+
+// Declared before the handlers refer to them.
+template <> const std::array<VM::TailHandler, OP_COUNT> VM::tailHandlers<RUN_PLAIN>;
+template <> const std::array<VM::TailHandler, OP_COUNT> VM::tailHandlers<RUN_TRACE>;
+template <> const std::array<VM::TailHandler, OP_COUNT> VM::tailHandlers<RUN_PROFILE>;
+
+#define TAIL_MODE RUN_PLAIN
+#include "VMHandlers.inc"
+TAIL_HANDLER_TABLE(RUN_PLAIN);
+#undef TAIL_MODE
+
+#define TAIL_MODE RUN_TRACE
+#include "VMHandlers.inc"
+TAIL_HANDLER_TABLE(RUN_TRACE);
+#undef TAIL_MODE
+
+#define TAIL_MODE RUN_PROFILE
+#include "VMHandlers.inc"
+TAIL_HANDLER_TABLE(RUN_PROFILE);
+#undef TAIL_MODE
+
+#undef TAIL_HANDLER_TABLE
+#undef HANDLER
+#undef DISPATCH
+#endif
+
+template <RunMode Mode>
+InterpretResult VM::runTailCall()
 {
-    return chunk->constants.values[readByte()];
+#ifdef CLOXX_HAS_MUSTTAIL
+    INSTRUMENT(Mode);
+    return (this->*tailHandlers<Mode>[readByte()])();
+#else
+    return runSwitch<Mode>();
+#endif
 }
 
-Value VM::peek(const int distance) const {
-    return stackTop[-1 - distance];
+#undef BINARY_OP
+#undef BINARY_NUM_OP
+#undef NOT_BOOL_VAL
+#undef INSTRUMENT
+
+void VM::traceExecution() const
+{
+    printf("          ");
+    for (const Value* slot = stack.data(); slot < stackTop; slot++)
+    {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+    disassembleInstruction(chunk, static_cast<int>(ip - chunk.code.data()));
 }
 
-bool VM::isFalsey(const Value& value)
+inline void VM::profileExecution() const
 {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+    profiler->enter(ip - chunk.code.data(), *ip);
 }
 
-bool VM::valuesEqual(const Value& a, const Value& b)
+// Called by a generic handler after its operand check passed.
+inline void VM::quicken(const std::uint8_t quick)
 {
-    if (a.type != b.type)
+    if (quickCode == nullptr)
     {
-        return false;
+        return;
+    }
+
+    quickCode[ip - 1 - chunk.code.data()] = quick;
+    if (profiler != nullptr)
+    {
+        profiler->quickened(quick);
     }
+}
 
-    switch (a.type)
+// Called by a quickened handler whose operand check failed: restores the
+// generic instruction and steps back so that it runs next.
+inline void VM::despecialize(const std::uint8_t generic)
+{
+    ip--;
+    const std::uint8_t quick = quickCode[ip - chunk.code.data()];
+    quickCode[ip - chunk.code.data()] = generic;
+    if (profiler != nullptr)
     {
-    case VAL_BOOL:      return AS_BOOL(a) == AS_BOOL(b);
-    case VAL_NIL:       return true;
-    case VAL_NUMBER:    return AS_NUMBER(a) == AS_NUMBER(b);
-    default:            return false; // Unreachable
+        profiler->despecialized(quick);
     }
 }
 
+inline std::uint8_t VM::readByte()
+{
+    return *ip++;
+}
+
+inline Value VM::readConstant()
+{
+    return chunk.constants[readByte()];
+}
+
+inline Value VM::readConstantLong()
+{
+    const std::uint32_t constant = readLongOperand(ip);
+    ip += 3;
+    return chunk.constants[constant];
+}
+
+Value VM::peek(const int distance) const {
+    return stackTop[-1 - distance];
+}
+
 void VM::resetStack()
 {
     stackTop = stack.data();
@@ -162,16 +531,110 @@ Value VM::pop()
     return *stackTop;
 }
 
+static std::uint64_t nanosecondsSince(const std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// A cycle under way ends in a step of its own, so that its telemetry is kept
+// apart from the full cycle that follows.
+void VM::collectGarbage()
+{
+    if (heap.getPhase() != GC_IDLE)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        collect(SIZE_MAX);
+        heap.endStep(nanosecondsSince(begin));
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    collect(SIZE_MAX);
+    heap.endStep(nanosecondsSince(begin));
+}
+
+// Called between instructions once the heap's allocation counter runs out.
+void VM::collectStep()
+{
+    const auto begin = std::chrono::steady_clock::now();
+    collect(heap.getOptions().stepWork);
+    heap.endStep(nanosecondsSince(begin));
+}
+
+// Advances the cycle, starting one if idle, by about work units: one per global
+// or extra root scanned and per string swept. Shading the stack, the inputs
+// and the result is not counted: the stack is bounded and the host sizes its
+// inputs. Stack slots take no write barrier, so the stack is shaded again once
+// the gray slots are all scanned, which ends marking.
+void VM::collect(std::size_t work)
+{
+    if (heap.getPhase() == GC_IDLE)
+    {
+        heap.beginMark();
+        globalCursor = 0;
+        extraCursor = 0;
+        shadeRoots();
+    }
+
+    if (heap.getPhase() == GC_MARK)
+    {
+        for (; work > 0 && globalCursor < globals.size(); work--)
+        {
+            heap.shade(globals[globalCursor].value);
+            heap.shade(globals[globalCursor++].name); // Compiled into this heap, see CompilerOptions::heap.
+        }
+        for (; work > 0 && extraCursor < extraRoots.size(); work--)
+        {
+            heap.shade(extraRoots[extraCursor++]);
+        }
+        if (globalCursor < globals.size() || extraCursor < extraRoots.size())
+        {
+            return;
+        }
+
+        shadeRoots();
+        heap.beginSweep();
+    }
+
+    heap.sweep(&work);
+}
+
+void VM::shadeRoots()
+{
+    for (const Value* slot = stack.data(); slot < stackTop; slot++)
+    {
+        heap.shade(*slot);
+    }
+    for (const Value& input : inputs)
+    {
+        heap.shade(input);
+    }
+    heap.shade(resultValue);
+}
+
+// Out of line, so that the run loops hold no string of their own.
+void VM::undefinedGlobal(const Global& global)
+{
+    runtimeError("Undefined variable '%s'.", formatValue(global.name).c_str());
+}
+
 void VM::runtimeError(const char* format, ...)
 {
+    char message[256];
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vsnprintf(message, sizeof(message), format, args);
     va_end(args);
-    fputs("\n", stderr);
 
-    const size_t instruction = ip - chunk->code.data() - 1;
-    const int line = chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+    const size_t instruction = ip - chunk.code.data() - 1;
+    const int line = chunk.getLine(instruction);
+    const std::string text = std::string(message) + "\n[line " + std::to_string(line) + "] in script\n";
+    if (errors != nullptr)
+    {
+        errors->append(text);
+    }
+    else
+    {
+        fputs(text.c_str(), stderr);
+    }
     resetStack();
 }
@@ -2,10 +2,21 @@
 
 #include <cstdint>
 #include <array>
+#include <functional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "Chunk.h"
 #include "Value.h"
 #include "Source.h"
+#include "Arena.h"
+#include "CompiledChunk.h"
+#include "Heap.h"
+
+class Profiler;
+class JitCode;
 
 constexpr int STACK_MAX = 256;
 
@@ -16,28 +27,195 @@ enum InterpretResult: std::uint8_t
     INTERPRET_RUNTIME_ERROR,
 };
 
+enum DispatchEngine: std::uint8_t
+{
+    DISPATCH_SWITCH,            // One switch inside a for loop. Always available.
+    DISPATCH_COMPUTED_GOTO,     // Label table with "goto *", needs GCC or Clang.
+    DISPATCH_TAIL_CALL,         // One function per opcode chained with [[clang::musttail]].
+};
+
+// Instrumentation compiled into an instantiation of the run loop.
+enum RunMode: std::uint8_t
+{
+    RUN_PLAIN,
+    RUN_TRACE,      // Prints the stack and each instruction before executing it.
+    RUN_PROFILE,    // Feeds the attached Profiler.
+};
+
 struct VM
 {
 public:
     VM();
 
     InterpretResult interpret(const Source& source);
+    InterpretResult interpret(const Chunk& chunk);
+    InterpretResult interpret(const ChunkView& chunk);
+
+    // Runs a chunk from compile(). One that failed to compile gives INTERPRET_COMPILE_ERROR.
+    InterpretResult run(const CompiledChunk& chunk);
+
+    static bool isDispatchEngineAvailable(DispatchEngine engine);
+    void setDispatchEngine(DispatchEngine engine);
+    DispatchEngine getDispatchEngine() const { return engine; }
+
+    // Prints the stack and each instruction before executing it.
+    void setTrace(bool enabled) { trace = enabled; }
+    bool getTrace() const { return trace; }
+
+    // Runs chunks as machine code where the JIT supports the platform and the
+    // chunk: interpret() compiles every chunk, run() only hot ones. Tracing and
+    // profiling always interpret.
+    void setJit(bool enabled) { jit = enabled; }
+    bool getJit() const { return jit; }
+
+    // Lets run() rewrite generic arithmetic and comparisons into forms
+    // specialized for numbers once they have seen numbers, and back when they
+    // see anything else. The VM rewrites its own copy of the code of each
+    // chunk, so chunks stay shareable between VMs.
+    void setQuickening(bool enabled);
+    bool getQuickening() const { return quickening; }
+
+    // Values of the inputs of the next runs, read by OP_INPUT. The span must
+    // outlive them; a chunk reading past its end fails with a runtime error.
+    void setInputs(std::span<const Value> values) { inputs = values; }
+
+    // Global variables outlive the run that defines them: any later chunk run
+    // by this VM sees them by name. Forgets every one of them.
+    void resetGlobals();
+
+    // Profiles every run into profiler until reset to null; takes precedence over tracing.
+    void setProfiler(Profiler* p) { profiler = p; }
+
+    // A string result built by the run lives in the heap of this VM: it stays
+    // valid until the next run ends, or while held in the extra roots.
+    const Value& lastResult() const { return resultValue; }
+
+    // Strings built by runs are collected a step at a time as runs allocate
+    // them; see Heap. Roots are the stack, the inputs, the last result, the
+    // global variables with their names and the extra roots.
+    void setGcOptions(const GcOptions& options) { heap.setOptions(options); }
+    const GcStats& getGcStats() const { return heap.getStats(); }
+
+    // Values the host keeps, such as results of earlier runs, that the
+    // collector must not free. The span must outlive the runs; the host may
+    // store into it the results of this VM, and values it already holds.
+    void setExtraRoots(std::span<const Value> values)
+    {
+        extraRoots = values;
+        extraCursor = 0; // A cycle under way scans them again.
+    }
+
+    // Finishes the cycle under way, then runs a whole one in a single pause:
+    // afterwards the heap holds only what the roots reach.
+    void collectGarbage();
+
+    // The heap of this VM, to compile chunks into: see CompilerOptions::heap.
+    Heap* stringHeap() { return &heap; }
+
+    // Appends runtime errors to buffer instead of printing them to stderr.
+    void setErrorOutput(std::string* buffer) { errors = buffer; }
 
 private:
-    Chunk* chunk = nullptr;
-    uint8_t* ip = nullptr;
+    using TailHandler = InterpretResult (VM::*)();
+
+    // Code of a chunk as quickened by this VM, which keeps the chunk alive so
+    // that its address is not reused.
+    struct QuickenedCode
+    {
+        CompiledChunk owner;
+        std::vector<std::uint8_t> code;
+    };
+    static constexpr std::size_t MAX_QUICKENED_CHUNKS = 64; // All are dropped when full.
+
+    // Slot of a global variable. A name read before any chunk defined it gets
+    // an undefined slot, which its definition fills in later.
+    struct Global
+    {
+        Value value;
+        bool defined = false;
+        Value name;
+    };
+
+    // Names compare by their characters: equal names interned in different
+    // tables, such as a Heap and the process-wide one, share a slot.
+    struct NameHash
+    {
+        std::size_t operator()(const Value& name) const
+        {
+            return IS_OBJ_STRING(name) ? AS_OBJ_STRING(name)->hash : std::hash<std::uint64_t>{}(valueBits(name));
+        }
+    };
+    struct NameEqual
+    {
+        bool operator()(const Value& a, const Value& b) const { return valuesEqual(a, b); }
+    };
+
+    // The slots of this VM for the global slots of a chunk, looked up by name
+    // the first time the chunk runs. Keeps the chunk alive, like QuickenedCode.
+    struct ResolvedGlobals
+    {
+        CompiledChunk owner;
+        std::vector<std::uint32_t> slots;
+    };
+    static constexpr std::size_t MAX_RESOLVED_CHUNKS = 64; // All are dropped when full.
+
+    ChunkView chunk{};
+    const uint8_t* ip = nullptr;
     std::array<Value, STACK_MAX> stack;
     Value* stackTop;
+    Value resultValue;
+    std::span<const Value> inputs;
+    std::vector<Global> globals;
+    std::unordered_map<Value, std::uint32_t, NameHash, NameEqual> globalIndex; // Name -> slot.
+    std::unordered_map<const std::uint8_t*, ResolvedGlobals> resolved; // By address of the original code.
+    std::vector<std::uint32_t> viewGlobalSlots; // Resolved on each run of a ChunkView, which has no owner.
+    const std::uint32_t* globalSlots = nullptr; // Of the running chunk: its global slot -> slot in globals.
+    Heap heap;
+    std::span<const Value> extraRoots;
+    std::size_t globalCursor = 0;   // Next global and extra root to scan, while marking.
+    std::size_t extraCursor = 0;
+    DispatchEngine engine;
+    bool trace = false;
+    bool jit = false;
+    bool quickening = false;
+    std::unordered_map<const std::uint8_t*, QuickenedCode> quickened; // By address of the original code.
+    std::uint8_t* quickCode = nullptr; // Writable code of the running chunk while quickening.
+    std::string* errors = nullptr;
+    Arena compileArena; // Holds the chunk compiled by interpret(const Source&).
+    Profiler* profiler = nullptr;
 
+    // One table per mode, handlers only chain to handlers of the same mode.
+    template <RunMode Mode> static const std::array<TailHandler, OP_COUNT> tailHandlers;
 
+    // Every engine is instantiated once per mode so that the plain loops carry no
+    // per-instruction check; the mode is chosen once per run.
     InterpretResult run();
+    InterpretResult runJit(const JitCode& code);
+    bool useJit() const { return jit && !trace && profiler == nullptr; }
+    template <RunMode Mode> InterpretResult run();
+    template <RunMode Mode> InterpretResult runSwitch();
+    template <RunMode Mode> InterpretResult runComputedGoto();
+    template <RunMode Mode> InterpretResult runTailCall();
+    template <OpCode op, RunMode Mode> InterpretResult tailHandler();
+    void traceExecution() const;
+    inline void profileExecution() const;
+
+    ChunkView quickenedView(const CompiledChunk& c);
+    const std::uint32_t* resolvedGlobals(const CompiledChunk& c);
+    void resolveGlobals(std::span<const Value> names, std::vector<std::uint32_t>* slots);
+    inline void quicken(std::uint8_t quick);
+    inline void despecialize(std::uint8_t generic);
+
     inline uint8_t readByte();
     inline Value readConstant();
+    inline Value readConstantLong();
     inline Value peek(int distance) const;
-    static inline bool isFalsey(const Value& value);
-    static bool valuesEqual(const Value& a, const Value& b);
     void resetStack();
     void push(Value value);
     Value pop();
     void runtimeError(const char* format, ...);
+    void undefinedGlobal(const Global& global);
+    void collectStep();
+    void collect(std::size_t work);
+    void shadeRoots();
 };
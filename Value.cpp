@@ -1,14 +1,50 @@
 #include "Value.h"
 
 #include <cstdio>
+#include <string>
+
+#include "Object.h"
+
+std::string formatValue(const Value& value)
+{
+    if (IS_BOOL(value))
+    {
+        return AS_BOOL(value) ? "true" : "false";
+    }
+    if (IS_NIL(value))
+    {
+        return "nil";
+    }
+    if (IS_STRING(value))
+    {
+        char scratch[SHORT_STRING_MAX];
+        return std::string(stringChars(value, scratch));
+    }
+
+    char number[32];
+    snprintf(number, sizeof(number), "%g", AS_NUMBER(value));
+    return number;
+}
 
 void printValue(const Value& value)
 {
-    switch (value.type)
+    if (IS_BOOL(value))
+    {
+        printf(AS_BOOL(value) ? "true" : "false");
+    }
+    else if (IS_NIL(value))
+    {
+        printf("nil");
+    }
+    else if (IS_NUMBER(value))
+    {
+        printf("%g", AS_NUMBER(value));
+    }
+    else if (IS_STRING(value))
     {
-        case VAL_BOOL: printf(AS_BOOL(value) ? "true" : "false"); break;
-        case VAL_NIL: printf("nil"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
+        char scratch[SHORT_STRING_MAX];
+        const std::string_view chars = stringChars(value, scratch);
+        fwrite(chars.data(), 1, chars.size(), stdout);
     }
 }
 
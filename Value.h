@@ -1,11 +1,72 @@
 #pragma once
 
+#include <bit>
 #include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+
+struct ObjString;
+
+#ifdef CLOXX_NAN_BOXING
+
+// Every Value is one 64-bit word. Numbers are stored as plain doubles, other
+// values hide in the payload of a quiet NaN that arithmetic never produces.
+using Value = std::uint64_t;
+
+constexpr std::uint64_t QNAN        = 0x7ffc000000000000;
+constexpr std::uint64_t TAG_NIL     = 1; // 01.
+constexpr std::uint64_t TAG_FALSE   = 2; // 10.
+constexpr std::uint64_t TAG_TRUE    = 3; // 11.
+
+// Long strings set the sign bit and keep their 48-bit address in the payload.
+// Short strings set bit 49 instead and pack their characters into bits 0-39,
+// their length into bits 40-42.
+constexpr std::uint64_t SIGN_BIT            = 0x8000000000000000;
+constexpr std::uint64_t SHORT_STRING_TAG    = 0x0002000000000000;
+constexpr std::uint64_t PAYLOAD_MASK        = 0x0000ffffffffffff;
+constexpr std::size_t SHORT_STRING_MAX      = 5;
+constexpr int SHORT_STRING_LENGTH_SHIFT     = 40;
+
+inline double valueToNum(const Value value)
+{
+    return std::bit_cast<double>(value);
+}
+
+inline Value numToValue(const double num)
+{
+    return std::bit_cast<Value>(num);
+}
+
+#define FALSE_VAL               (static_cast<Value>(QNAN | TAG_FALSE))
+#define TRUE_VAL                (static_cast<Value>(QNAN | TAG_TRUE))
+
+#define IS_BOOL(value)          (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)           ((value) == NIL_VAL)
+#define IS_NUMBER(value)        (((value) & QNAN) != QNAN)
+#define IS_OBJ_STRING(value)    (((value) & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN))
+#define IS_SHORT_STRING(value)  (((value) & (SIGN_BIT | QNAN | SHORT_STRING_TAG)) == (QNAN | SHORT_STRING_TAG))
+
+#define BOOL_VAL(value)         ((value) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL                 (static_cast<Value>(QNAN | TAG_NIL))
+#define NUMBER_VAL(value)       numToValue(value)
+#define OBJ_STRING_VAL(string)  (SIGN_BIT | QNAN | reinterpret_cast<std::uint64_t>(string))
+#define SHORT_STRING_VAL(bits)  (QNAN | SHORT_STRING_TAG | (bits))
+
+#define AS_BOOL(value)          ((value) == TRUE_VAL)
+#define AS_NUMBER(value)        valueToNum(value)
+#define AS_OBJ_STRING(value)    reinterpret_cast<ObjString*>((value) & PAYLOAD_MASK)
+#define AS_SHORT_STRING(value)  ((value) & PAYLOAD_MASK)
+
+#else
 
 enum ValueType: std::uint8_t
 {
     VAL_BOOL,
     VAL_NIL,
+    VAL_OBJ_STRING,
+    VAL_SHORT_STRING,
     VAL_NUMBER,
 };
 
@@ -15,28 +76,141 @@ struct Value
     union {
         bool boolean;
         double number;
+        ObjString* string;
+        std::uint64_t shortString;
     } as;
 };
 
+// Short strings pack their characters into bits 0-55, their length into the top byte.
+constexpr std::size_t SHORT_STRING_MAX      = 7;
+constexpr int SHORT_STRING_LENGTH_SHIFT     = 56;
+
 #define IS_BOOL(value)          ((value).type == VAL_BOOL)
 #define IS_NIL(value)           ((value).type == VAL_NIL)
 #define IS_NUMBER(value)        ((value).type == VAL_NUMBER)
+#define IS_OBJ_STRING(value)    ((value).type == VAL_OBJ_STRING)
+#define IS_SHORT_STRING(value)  ((value).type == VAL_SHORT_STRING)
 
 #define BOOL_VAL(value)         ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL                 ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value)       ((Value){VAL_NUMBER, {.number = value}})
+#define OBJ_STRING_VAL(object)  ((Value){VAL_OBJ_STRING, {.string = object}})
+#define SHORT_STRING_VAL(bits)  ((Value){VAL_SHORT_STRING, {.shortString = bits}})
+
+#define AS_BOOL(value)          ((value).as.boolean)
+#define AS_NUMBER(value)        ((value).as.number)
+#define AS_OBJ_STRING(value)    ((value).as.string)
+#define AS_SHORT_STRING(value)  ((value).as.shortString)
+
+#endif
 
-#define AS_BOOL(value)      ((value).as.boolean)
-#define AS_NUMBER(value)    ((value).as.number)
+// Strings of up to SHORT_STRING_MAX characters are always short, longer ones
+// always ObjStrings. Equal short strings have equal bits, and so do equal
+// ObjStrings interned in the same table.
+#define IS_STRING(value)        (IS_OBJ_STRING(value) || IS_SHORT_STRING(value))
+
+// Whether two ObjStrings hold the same characters, for strings of different tables.
+bool stringsEqual(const ObjString* a, const ObjString* b);
+
+// Bits of a short string: character i in byte i, the length above them.
+inline std::uint64_t packShortString(const char* chars, const std::size_t length)
+{
+    std::uint64_t bits = static_cast<std::uint64_t>(length) << SHORT_STRING_LENGTH_SHIFT;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        bits |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(chars[i])) << (8 * i);
+    }
+    return bits;
+}
+
+inline std::size_t shortStringLength(const std::uint64_t bits)
+{
+    return static_cast<std::size_t>(bits >> SHORT_STRING_LENGTH_SHIFT & 0xff);
+}
+
+// IS_NUMBER(a) && IS_NUMBER(b) with a single branch.
+inline bool areNumbers(const Value& a, const Value& b)
+{
+#ifdef CLOXX_NAN_BOXING
+    return ((a & QNAN) != QNAN) & ((b & QNAN) != QNAN);
+#else
+    static_assert(VAL_NUMBER > VAL_BOOL && VAL_NUMBER > VAL_NIL, "Only two numbers add up to 2 * VAL_NUMBER.");
+    return a.type + b.type == 2 * VAL_NUMBER;
+#endif
+}
+
+inline bool isFalsey(const Value& value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+inline bool valuesEqual(const Value& a, const Value& b)
+{
+#ifdef CLOXX_NAN_BOXING
+    // Compare numbers as doubles so that NaN != NaN and 0 == -0.
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+    {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+
+    return a == b || (IS_OBJ_STRING(a) && IS_OBJ_STRING(b) && stringsEqual(AS_OBJ_STRING(a), AS_OBJ_STRING(b)));
+#else
+    if (a.type != b.type)
+    {
+        return false;
+    }
+
+    switch (a.type)
+    {
+    case VAL_BOOL:          return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_NIL:           return true;
+    case VAL_OBJ_STRING:    return AS_OBJ_STRING(a) == AS_OBJ_STRING(b) || stringsEqual(AS_OBJ_STRING(a), AS_OBJ_STRING(b));
+    case VAL_SHORT_STRING:  return AS_SHORT_STRING(a) == AS_SHORT_STRING(b);
+    case VAL_NUMBER:        return AS_NUMBER(a) == AS_NUMBER(b);
+    default:                return false; // Unreachable
+    }
+#endif
+}
+
+// Hash key of a value, from its bits. Values of different types may share a
+// key, so matches are confirmed with valuesIdentical().
+inline std::uint64_t valueBits(const Value& value)
+{
+#ifdef CLOXX_NAN_BOXING
+    return value;
+#else
+    switch (value.type)
+    {
+    case VAL_BOOL:          return AS_BOOL(value);
+    case VAL_OBJ_STRING:    return reinterpret_cast<std::uintptr_t>(AS_OBJ_STRING(value));
+    case VAL_SHORT_STRING:  return AS_SHORT_STRING(value);
+    case VAL_NUMBER:        return std::bit_cast<std::uint64_t>(AS_NUMBER(value));
+    default:                return 0;
+    }
+#endif
+}
+
+// Same type and same bits. Unlike valuesEqual(), 0 and -0 differ and a NaN is
+// identical to itself, which is what sharing a constant requires.
+inline bool valuesIdentical(const Value& a, const Value& b)
+{
+#ifdef CLOXX_NAN_BOXING
+    return a == b;
+#else
+    return a.type == b.type && valueBits(a) == valueBits(b);
+#endif
+}
 
 void printValue(const Value& value);
+std::string formatValue(const Value& value); // Same text as printValue().
 
 class ValueArray
 {
 public:
-    std::vector<Value> values;
+    std::pmr::vector<Value> values;
 
     ValueArray() = default;
+    explicit ValueArray(std::pmr::memory_resource* resource) : values(resource) {}
 
     void writeValue(const Value& value);
 };
@@ -0,0 +1,81 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+WorkStealingPool::WorkStealingPool(const unsigned workers)
+    : workers(std::max(workers, 1u))
+    , queues(std::make_unique<Queue[]>(this->workers))
+{
+}
+
+void WorkStealingPool::run(const std::size_t jobCount,
+                           const std::function<void(unsigned worker, std::size_t index)>& job)
+{
+    // Jobs are never added while running, so a worker that finds every queue
+    // empty can stop: whatever is left is already being run by someone else.
+    for (unsigned worker = 0; worker < workers; worker++)
+    {
+        const std::size_t first = jobCount * worker / workers;
+        const std::size_t last = jobCount * (worker + 1) / workers;
+        for (std::size_t index = first; index < last; index++)
+        {
+            queues[worker].jobs.push_back(index);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (unsigned worker = 1; worker < workers; worker++)
+    {
+        threads.emplace_back([this, worker, &job] { work(worker, job); });
+    }
+
+    work(0, job);
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::work(const unsigned worker, const std::function<void(unsigned worker, std::size_t index)>& job)
+{
+    std::size_t index;
+    while (take(worker, &index))
+    {
+        job(worker, index);
+    }
+}
+
+bool WorkStealingPool::take(const unsigned worker, std::size_t* index)
+{
+    {
+        Queue& own = queues[worker];
+        std::lock_guard lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            *index = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    for (unsigned i = 1; i < workers; i++)
+    {
+        Queue& victim = queues[(worker + i) % workers];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            *index = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Runs a fixed set of jobs on a fixed number of threads. Each worker starts with
+// a contiguous share of the job indices and takes them in order from the front
+// of its own queue. Once that queue is empty it steals from the back of the
+// others, so a worker held up by one slow job does not leave the rest of its
+// share waiting.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(unsigned workers);
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned workerCount() const { return workers; }
+
+    // Calls job(worker, index) once for every index below jobCount, and returns
+    // once every call has returned. The calling thread is worker 0. Calls made
+    // on the same worker never overlap, so per-worker state needs no locking.
+    void run(std::size_t jobCount, const std::function<void(unsigned worker, std::size_t index)>& job);
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::size_t> jobs;
+    };
+
+    unsigned workers;
+    std::unique_ptr<Queue[]> queues;
+
+    bool take(unsigned worker, std::size_t* index);
+    void work(unsigned worker, const std::function<void(unsigned worker, std::size_t index)>& job);
+};
@@ -0,0 +1,510 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define CLOXX_BENCH_SERVE
+#endif
+
+#include "Arena.h"
+#include "Chunk.h"
+#include "ColumnVM.h"
+#include "CompiledChunk.h"
+#include "Compiler.h"
+#include "Heap.h"
+#include "Jit.h"
+#include "Scanner.h"
+#include "Server.h"
+#include "ScannerKernels.h"
+#include "Source.h"
+#include "Value.h"
+#include "VM.h"
+
+#include "Harness.h"
+#include "Workloads.h"
+
+#ifndef CLOXX_BENCH_CORPUS_DIR
+#define CLOXX_BENCH_CORPUS_DIR "bench/corpus"
+#endif
+
+static const char* kernelName(const ScanKernel kernel)
+{
+    switch (kernel)
+    {
+    case SCAN_SCALAR:   return "scalar";
+    case SCAN_SSE2:     return "sse2";
+    case SCAN_AVX2:     return "avx2";
+    default:            return "unknown";
+    }
+}
+
+static const char* columnKernelName(const ColumnKernel kernel)
+{
+    switch (kernel)
+    {
+    case COLUMN_SCALAR: return "columns/scalar";
+    case COLUMN_SSE2:   return "columns/sse2";
+    case COLUMN_AVX2:   return "columns/avx2";
+    default:            return "unknown";
+    }
+}
+
+static const char* engineName(const DispatchEngine engine)
+{
+    switch (engine)
+    {
+    case DISPATCH_SWITCH:           return "switch";
+    case DISPATCH_COMPUTED_GOTO:    return "computed_goto";
+    case DISPATCH_TAIL_CALL:        return "tail_call";
+    default:                        return "unknown";
+    }
+}
+
+static std::vector<Token> scanAll(const Source& source, const ScanKernel kernel)
+{
+    std::vector<Token> tokens;
+    Scanner scanner(source, kernel);
+    for (;;)
+    {
+        const Token token = scanner.nextToken();
+        tokens.push_back(token);
+        if (token.type == TOKEN_EOF) return tokens;
+    }
+}
+
+static bool sameTokens(const std::vector<Token>& a, const std::vector<Token>& b)
+{
+    if (a.size() != b.size()) return false;
+
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].type != b[i].type || a[i].start != b[i].start || a[i].length != b[i].length ||
+            a[i].line != b[i].line)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Straight-line code runs every instruction once.
+static long countInstructions(const Chunk& chunk)
+{
+    long count = 0;
+    for (std::size_t offset = 0; offset < chunk.code.size(); count++)
+    {
+        offset += instructionLength(chunk.code[offset]);
+    }
+    return count;
+}
+
+// Scans with every kernel, checking each token stream against the scalar one.
+static bool benchScan(const BenchConfig& config, const Workload& workload, const Source& source, Report& report)
+{
+    const std::vector<Token> expected = scanAll(source, SCAN_SCALAR);
+    for (const ScanKernel kernel : {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2})
+    {
+        if (!isScanKernelAvailable(kernel)) continue;
+
+        if (!sameTokens(scanAll(source, kernel), expected))
+        {
+            fprintf(stderr, "%s: %s scanner differs from the scalar one\n", workload.name.c_str(), kernelName(kernel));
+            return false;
+        }
+
+        const Stats stats = measure(config, [&]
+        {
+            Scanner scanner(source, kernel);
+            while (scanner.nextToken().type != TOKEN_EOF) {}
+        });
+        report.add(Result{workload.name, "scan", kernelName(kernel), stats, source.size(),
+                          static_cast<long>(expected.size())});
+    }
+    return true;
+}
+
+// Compiles into heap vectors, then into an arena reset before every script.
+static void benchCompile(const BenchConfig& config, const Workload& workload, const Source& source, Report& report)
+{
+    const Stats heap = measure(config, [&]
+    {
+        Compiler compiler;
+        Chunk chunk;
+        compiler.compile(source, &chunk);
+    });
+    report.add(Result{workload.name, "compile", "heap", heap, source.size(), static_cast<long>(source.size())});
+
+    Arena arena;
+    const Stats arenaStats = measure(config, [&]
+    {
+        arena.reset(Compiler::arenaBytes(source.size()));
+        Compiler compiler;
+        Chunk chunk(arena.resource());
+        compiler.compile(source, &chunk);
+    });
+    report.add(Result{workload.name, "compile", "arena", arenaStats, source.size(),
+                      static_cast<long>(source.size())});
+}
+
+// Runs the workload compiled with each set of options on every dispatch engine,
+// checking that all engines return the same value.
+static bool benchRun(const BenchConfig& config, const Workload& workload, const Source& source, Report& report)
+{
+    struct Variant
+    {
+        const char* name;
+        CompilerOptions options;
+    };
+    // Without folding the corpus keeps all its operators, which is what the VM should be measured on.
+    const Variant variants[] = {
+        {"unfolded_checked", CompilerOptions{false, false, false}},
+        {"unfolded", CompilerOptions{false, false}},
+        {"unfolded_peephole", CompilerOptions{false, true}},
+        {"default", CompilerOptions{}},
+    };
+
+    for (const Variant& variant : variants)
+    {
+        Compiler compiler(variant.options);
+        Chunk chunk;
+        if (!compiler.compile(source, &chunk)) continue;
+
+        VM reference;
+        reference.setDispatchEngine(DISPATCH_SWITCH);
+        if (reference.interpret(chunk) != INTERPRET_OK) continue;
+
+        for (const DispatchEngine engine : {DISPATCH_SWITCH, DISPATCH_COMPUTED_GOTO, DISPATCH_TAIL_CALL})
+        {
+            if (!VM::isDispatchEngineAvailable(engine)) continue;
+
+            VM vm;
+            vm.setDispatchEngine(engine);
+            if (vm.interpret(chunk) != INTERPRET_OK || !valuesEqual(vm.lastResult(), reference.lastResult()))
+            {
+                fprintf(stderr, "%s: %s engine disagrees with the switch engine\n", workload.name.c_str(),
+                        engineName(engine));
+                return false;
+            }
+
+            const Stats stats = measure(config, [&] { vm.interpret(chunk); });
+            report.add(Result{workload.name, "run", std::string(variant.name) + "/" + engineName(engine), stats,
+                              chunk.code.size(), countInstructions(chunk)});
+        }
+
+        // Quickened by the first run, on the default engine.
+        const CompiledChunk compiled = compile(source, variant.options);
+        {
+            VM vm;
+            vm.setQuickening(true);
+            vm.run(compiled);
+            if (vm.run(compiled) != INTERPRET_OK || !valuesEqual(vm.lastResult(), reference.lastResult()))
+            {
+                fprintf(stderr, "%s: quickened code disagrees with the switch engine\n", workload.name.c_str());
+                return false;
+            }
+
+            const Stats stats = measure(config, [&] { vm.run(compiled); });
+            report.add(Result{workload.name, "run", std::string(variant.name) + "/quickened", stats,
+                              chunk.code.size(), countInstructions(chunk)});
+        }
+
+        if (!JitCode::isAvailable()) continue;
+
+        // Warmed up past JIT_HOT_RUNS, so that the timed runs are all machine code.
+        VM vm;
+        vm.setJit(true);
+        for (std::uint32_t i = 0; i <= JIT_HOT_RUNS; i++) vm.run(compiled);
+        if (compiled.hotJitCode() == nullptr) continue; // Too large for the JIT.
+
+        if (!valuesEqual(vm.lastResult(), reference.lastResult()))
+        {
+            fprintf(stderr, "%s: JIT disagrees with the switch engine\n", workload.name.c_str());
+            return false;
+        }
+
+        const Stats stats = measure(config, [&] { vm.run(compiled); });
+        report.add(Result{workload.name, "run", std::string(variant.name) + "/jit", stats, chunk.code.size(),
+                          countInstructions(chunk)});
+    }
+    return true;
+}
+
+// Pauses of the collector, not the runs: each run gets a fresh VM whose heap
+// starts small, so that scripts building some kilobytes of strings go through
+// several cycles. Runs repeat until there are enough pauses for a p99.
+// Incremental steps are compared with finishing each cycle in the step that
+// starts it. Workloads that build no string at run time are skipped.
+static void benchCollector(const BenchConfig& config, const Workload& workload, const Source& source,
+                           Report& report)
+{
+    const CompiledChunk compiled = compile(source);
+    {
+        VM vm;
+        if (vm.run(compiled) != INTERPRET_OK || vm.getGcStats().bytesAllocated == 0) return;
+    }
+
+    struct Variant
+    {
+        const char* name;
+        std::size_t stepWork;
+    };
+    const Variant variants[] = {{"incremental", 32}, {"stop_the_world", SIZE_MAX}};
+
+    for (const Variant& variant : variants)
+    {
+        GcOptions options;
+        options.minimumHeap = 4 * 1024;
+        options.stepBytes = 1024;
+        options.stepWork = variant.stepWork;
+
+        PauseHistogram pauses;
+        const auto wanted = static_cast<std::uint64_t>(config.samples) * 10;
+        for (int run = 0; run < 4096 && pauses.count() < wanted; run++)
+        {
+            VM vm;
+            vm.setGcOptions(options);
+            vm.run(compiled);
+            pauses.add(vm.getGcStats().pauses);
+        }
+        if (pauses.count() == 0) continue;
+
+        Stats stats;
+        stats.medianNs = static_cast<double>(pauses.percentileNs(0.5));
+        stats.p99Ns = static_cast<double>(pauses.percentileNs(0.99));
+        stats.meanNs = static_cast<double>(pauses.totalNs()) / static_cast<double>(pauses.count());
+        stats.calls = static_cast<long>(pauses.count());
+        report.add(Result{workload.name, "gc", variant.name, stats, source.size(), 0});
+    }
+}
+
+// One rule over a table of rows, evaluated a row at a time through a VM bound
+// to the inputs of each row, then a block of rows at a time with every column
+// kernel. Every 97th discount is nil, so those rows fail and must be reported
+// failed by the column VM as well.
+static bool benchColumns(const BenchConfig& config, Report& report)
+{
+    constexpr std::size_t ROWS = 1 << 16;
+    CompilerOptions options;
+    options.inputs = {"price", "quantity", "discount", "flagged"};
+    const CompiledChunk rule = compile("(price * quantity - discount) / quantity >= 20 == !flagged", options);
+    if (!rule.isValid())
+    {
+        fprintf(stderr, "columns: %s", rule.errors().c_str());
+        return false;
+    }
+
+    std::vector<double> prices(ROWS);
+    std::vector<double> quantities(ROWS);
+    std::vector<Value> discounts(ROWS);
+    std::vector<Value> flags(ROWS);
+    std::vector<Value> rows(ROWS * 4);
+    for (std::size_t i = 0; i < ROWS; i++)
+    {
+        prices[i] = static_cast<double>(i % 1000) / 10;
+        quantities[i] = static_cast<double>(i % 7 + 1);
+        discounts[i] = i % 97 == 0 ? NIL_VAL : NUMBER_VAL(static_cast<double>(i % 13));
+        flags[i] = i % 5 == 0 ? NIL_VAL : BOOL_VAL(i % 3 == 0);
+
+        Value* row = &rows[i * 4];
+        row[0] = NUMBER_VAL(prices[i]);
+        row[1] = NUMBER_VAL(quantities[i]);
+        row[2] = discounts[i];
+        row[3] = flags[i];
+    }
+
+    std::vector<Value> expected(ROWS);
+    std::vector<bool> expectedFailed(ROWS);
+    VM vm;
+    std::string errors;
+    vm.setErrorOutput(&errors);
+    const auto runRows = [&](const bool keep)
+    {
+        for (std::size_t i = 0; i < ROWS; i++)
+        {
+            vm.setInputs(std::span<const Value>(&rows[i * 4], 4));
+            const bool ok = vm.run(rule) == INTERPRET_OK;
+            if (keep)
+            {
+                expected[i] = vm.lastResult();
+                expectedFailed[i] = !ok;
+            }
+        }
+        errors.clear();
+    };
+    runRows(true);
+
+    const ChunkView view = rule.view();
+    const Stats rowStats = measure(config, [&] { runRows(false); });
+    report.add(Result{"columns", "run", "rows", rowStats, view.code.size(), static_cast<long>(ROWS)});
+
+    for (const ColumnKernel kernel : {COLUMN_SCALAR, COLUMN_SSE2, COLUMN_AVX2})
+    {
+        if (!isColumnKernelAvailable(kernel)) continue;
+
+        ColumnVM columns;
+        columns.setKernel(kernel);
+        columns.bindNumbers(0, prices);
+        columns.bindNumbers(1, quantities);
+        columns.bindValues(2, discounts);
+        columns.bindValues(3, flags);
+
+        ColumnResults results;
+        if (columns.run(rule, ROWS, &results) != INTERPRET_OK) return false;
+        for (std::size_t i = 0; i < ROWS; i++)
+        {
+            if (results.hasFailed(i) != expectedFailed[i] ||
+                (!expectedFailed[i] && !valuesEqual(results.values[i], expected[i])))
+            {
+                fprintf(stderr, "columns: %s kernels disagree with the VM on row %zu\n", columnKernelName(kernel), i);
+                return false;
+            }
+        }
+
+        const Stats stats = measure(config, [&] { columns.run(rule, ROWS, &results); });
+        report.add(Result{"columns", "run", columnKernelName(kernel), stats, view.code.size(), static_cast<long>(ROWS)});
+    }
+    return true;
+}
+
+// Evaluates through the server: in process, then over a Unix socket one request
+// at a time for latency and in batches of pipelined requests for throughput.
+// Repeated expressions hit the server's chunk cache, as they would in practice.
+static bool benchServe(const BenchConfig& config, const Workload& workload, EvalClient& client, Report& report)
+{
+    EvalServer local;
+    const std::string expected = local.evaluate(workload.text);
+    if (expected.compare(0, 3, "ok\t") != 0) return true;
+
+    const Stats direct = measure(config, [&] { local.evaluate(workload.text); });
+    report.add(Result{workload.name, "serve", "in_process", direct, workload.text.size(), 1});
+
+    std::string response;
+    if (!client.evaluate(workload.text, &response) || response != expected)
+    {
+        fprintf(stderr, "%s: socket response \"%s\" differs from \"%s\"\n", workload.name.c_str(),
+                response.c_str(), expected.c_str());
+        return false;
+    }
+
+    const Stats roundTrip = measure(config, [&] { client.evaluate(workload.text, &response); });
+    report.add(Result{workload.name, "serve", "socket_roundtrip", roundTrip, workload.text.size(), 1});
+
+    constexpr int PIPELINE_DEPTH = 64;
+    const Stats pipelined = measure(config, [&]
+    {
+        for (int i = 0; i < PIPELINE_DEPTH; i++) client.send(workload.text);
+        for (int i = 0; i < PIPELINE_DEPTH; i++) client.receive(&response);
+    });
+    report.add(Result{workload.name, "serve", "socket_pipelined", pipelined, workload.text.size(), PIPELINE_DEPTH});
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: cloxx_bench [--corpus dir] [--json path] [--quick]\n");
+}
+
+int main(const int argc, char* argv[])
+{
+    BenchConfig config;
+    std::string corpus = CLOXX_BENCH_CORPUS_DIR;
+    const char* jsonPath = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) corpus = argv[++i];
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) jsonPath = argv[++i];
+        else if (std::strcmp(argv[i], "--quick") == 0) config = BenchConfig{1, 21, 10000};
+        else
+        {
+            usage();
+            return 64;
+        }
+    }
+
+    std::vector<Workload> workloads = loadCorpus(corpus);
+    if (workloads.empty())
+    {
+        fprintf(stderr, "No .lox workloads in \"%s\".\n", corpus.c_str());
+        return 66;
+    }
+    workloads.push_back(generateExpression(4 * 1024 * 1024));
+    workloads.push_back(generateTokenSoup(8 * 1024 * 1024));
+
+    Report report;
+#ifdef CLOXX_NAN_BOXING
+    report.addInfo("value_layout", "nan_boxed");
+#else
+    report.addInfo("value_layout", "tagged_union");
+#endif
+    report.addInfo("sizeof_value", std::to_string(sizeof(Value)));
+    report.addInfo("best_scan_kernel", kernelName(bestScanKernel()));
+    report.addInfo("best_column_kernel", columnKernelName(bestColumnKernel()));
+
+    for (const Workload& workload : workloads)
+    {
+        const Source source(workload.text);
+        if (!benchScan(config, workload, source, report)) return 1;
+        if (!workload.compiles) continue;
+
+        benchCompile(config, workload, source, report);
+        if (!benchRun(config, workload, source, report)) return 1;
+        benchCollector(config, workload, source, report);
+    }
+    if (!benchColumns(config, report)) return 1;
+
+#ifdef CLOXX_BENCH_SERVE
+    // The server only runs the small corpus scripts: shipping megabytes per
+    // request would measure the socket, not the server.
+    char socketDirectory[] = "/tmp/cloxx_bench_XXXXXX";
+    if (mkdtemp(socketDirectory) != nullptr)
+    {
+        const std::string socketPath = std::string(socketDirectory) + "/serve.sock";
+        EvalServer server;
+        std::thread serverThread([&] { server.serveSocket(socketPath.c_str()); });
+
+        bool ok = true;
+        {
+            EvalClient client;
+            bool connected = false;
+            for (int attempt = 0; attempt < 100 && !connected; attempt++)
+            {
+                connected = client.connect(socketPath.c_str());
+                if (!connected) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (!connected) fprintf(stderr, "Skipping the serve phase: %s\n", client.error().c_str());
+
+            for (std::size_t i = 0; connected && ok && i < workloads.size(); i++)
+            {
+                if (workloads[i].compiles && workloads[i].text.size() < 64 * 1024)
+                {
+                    ok = benchServe(config, workloads[i], client, report);
+                }
+            }
+        }
+
+        // Closing the client ends the connection, so the server is back in accept().
+        server.stop();
+        serverThread.join();
+        rmdir(socketDirectory);
+        if (!ok) return 1;
+    }
+#endif
+
+    report.printTable(stderr);
+
+    std::FILE* out = jsonPath != nullptr ? std::fopen(jsonPath, "w") : stdout;
+    if (out == nullptr)
+    {
+        fprintf(stderr, "Failed to open \"%s\".\n", jsonPath);
+        return 74;
+    }
+    report.writeJson(out);
+    if (out != stdout) std::fclose(out);
+
+    return 0;
+}
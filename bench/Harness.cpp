@@ -0,0 +1,69 @@
+#include "Harness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <string>
+#include <vector>
+
+Stats summarize(std::vector<double> perCallNs, const long calls)
+{
+    Stats stats;
+    if (perCallNs.empty()) return stats;
+
+    std::sort(perCallNs.begin(), perCallNs.end());
+    const std::size_t count = perCallNs.size();
+    const auto p99 = static_cast<std::size_t>(std::ceil(0.99 * static_cast<double>(count))) - 1;
+
+    stats.medianNs = perCallNs[count / 2];
+    stats.p99Ns = perCallNs[std::min(p99, count - 1)];
+    stats.meanNs = std::accumulate(perCallNs.begin(), perCallNs.end(), 0.0) / static_cast<double>(count);
+    stats.calls = calls;
+    return stats;
+}
+
+void Report::addInfo(const std::string& name, const std::string& value)
+{
+    info.emplace_back(name, value);
+}
+
+void Report::add(const Result& result)
+{
+    results.push_back(result);
+}
+
+void Report::printTable(std::FILE* out) const
+{
+    fprintf(out, "%-14s %-8s %-32s %10s %12s %12s %14s\n",
+            "workload", "phase", "variant", "bytes", "median us", "p99 us", "items/s");
+    for (const Result& result : results)
+    {
+        const double perSecond = result.stats.medianNs > 0 ? result.items * 1e9 / result.stats.medianNs : 0;
+        fprintf(out, "%-14s %-8s %-32s %10zu %12.3f %12.3f %14.4g\n",
+                result.workload.c_str(), result.phase.c_str(), result.variant.c_str(), result.bytes,
+                result.stats.medianNs / 1000, result.stats.p99Ns / 1000, perSecond);
+    }
+}
+
+// Names and variants only contain identifier characters, so no escaping is needed.
+void Report::writeJson(std::FILE* out) const
+{
+    fprintf(out, "{\n  \"info\": {");
+    for (std::size_t i = 0; i < info.size(); i++)
+    {
+        fprintf(out, "%s\"%s\": \"%s\"", i == 0 ? "" : ", ", info[i].first.c_str(), info[i].second.c_str());
+    }
+    fprintf(out, "},\n  \"results\": [\n");
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const Result& result = results[i];
+        fprintf(out,
+                "    {\"workload\": \"%s\", \"phase\": \"%s\", \"variant\": \"%s\", \"bytes\": %zu, "
+                "\"items\": %ld, \"calls\": %ld, \"median_ns\": %.1f, \"p99_ns\": %.1f, \"mean_ns\": %.1f}%s\n",
+                result.workload.c_str(), result.phase.c_str(), result.variant.c_str(), result.bytes,
+                result.items, result.stats.calls, result.stats.medianNs, result.stats.p99Ns,
+                result.stats.meanNs, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
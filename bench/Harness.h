@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct BenchConfig
+{
+    int warmup = 3;                 // Untimed calls before calibration.
+    int samples = 101;              // Timed batches, enough for a meaningful p99.
+    double minSampleNs = 50000;     // Batches repeat the call until they last this long.
+};
+
+// Per-call times of one measurement, in nanoseconds. For the gc phase, pause
+// times of the collector instead of calls.
+struct Stats
+{
+    double medianNs = 0;
+    double p99Ns = 0;
+    double meanNs = 0;
+    long calls = 0;
+};
+
+struct Result
+{
+    std::string workload;
+    std::string phase;              // "scan", "compile", "run", "gc" or "serve".
+    std::string variant;            // Kernel, engine or compiler options.
+    Stats stats;
+    std::size_t bytes = 0;          // Input size: source bytes or code bytes.
+    long items = 0;                 // Tokens, instructions, ... processed per call.
+};
+
+Stats summarize(std::vector<double> perCallNs, long calls);
+
+// Calls f until warm, calibrates a batch size so that one sample lasts at least
+// minSampleNs, then times config.samples batches.
+template <typename F>
+Stats measure(const BenchConfig& config, F&& f)
+{
+    using Clock = std::chrono::steady_clock;
+
+    for (int i = 0; i < config.warmup; i++) f();
+
+    long batch = 1;
+    for (;;)
+    {
+        const auto begin = Clock::now();
+        for (long i = 0; i < batch; i++) f();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+        if (ns >= config.minSampleNs || batch >= (1L << 24)) break;
+        batch *= 2;
+    }
+
+    std::vector<double> perCallNs;
+    perCallNs.reserve(config.samples);
+    for (int sample = 0; sample < config.samples; sample++)
+    {
+        const auto begin = Clock::now();
+        for (long i = 0; i < batch; i++) f();
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+        perCallNs.push_back(ns / static_cast<double>(batch));
+    }
+
+    return summarize(std::move(perCallNs), batch * config.samples);
+}
+
+class Report
+{
+public:
+    void addInfo(const std::string& name, const std::string& value);
+    void add(const Result& result);
+    void printTable(std::FILE* out) const;
+    void writeJson(std::FILE* out) const;
+
+private:
+    std::vector<std::pair<std::string, std::string>> info;
+    std::vector<Result> results;
+};
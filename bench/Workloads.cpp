@@ -0,0 +1,69 @@
+#include "Workloads.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+std::vector<Workload> loadCorpus(const std::string& directory)
+{
+    std::vector<Workload> workloads;
+
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        if (!entry.is_regular_file() || entry.path().extension() != ".lox") continue;
+
+        std::ifstream file(entry.path(), std::ios::in | std::ios::binary);
+        std::ostringstream text;
+        text << file.rdbuf();
+        workloads.push_back(Workload{entry.path().stem().string(), text.str()});
+    }
+
+    std::sort(workloads.begin(), workloads.end(),
+              [](const Workload& a, const Workload& b) { return a.name < b.name; });
+    return workloads;
+}
+
+// One long expression spread over many lines, the shape of generated rule files.
+Workload generateExpression(const std::size_t size)
+{
+    static const char* const lines[] = {
+        "(12.5 + 7) * 3 - 4 / 2 +\n",
+        "-(8 - 2.25) * (1 + 2 + 3) -\n",
+        "// generated section\n(100 / 7.5) * 0.5 +\n",
+        "((1 + 2) * (3 + 4) - (5 * 6)) / 9 -\n",
+    };
+
+    Workload workload{"generated_expr", ""};
+    workload.text.reserve(size + 64);
+    for (std::size_t i = 0; workload.text.size() < size; i++)
+    {
+        workload.text += lines[i % std::size(lines)];
+    }
+    workload.text += "0\n";
+    return workload;
+}
+
+// Identifier, number, string and comment heavy text, only meant for the scanner.
+Workload generateTokenSoup(const std::size_t size)
+{
+    static const char* const lines[] = {
+        "configuration_value_12 + other_identifier * (3.25 - count) // trailing comment\n",
+        "   and_also_this >= 1024.5 or !flag_with_long_name != nil\n",
+        "\t\"a string literal that is long enough to span a vector\" + 42 * 0.001\n",
+        "// a full line comment with some words in it, followed by an empty line\n\n",
+        "while var_1 < 100 { print var_1; var_1 = var_1 + 1; }\n",
+    };
+
+    Workload workload{"generated_soup", "", false};
+    workload.text.reserve(size + 128);
+    for (std::size_t i = 0; workload.text.size() < size; i++)
+    {
+        workload.text += lines[i % std::size(lines)];
+    }
+    return workload;
+}
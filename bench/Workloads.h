@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct Workload
+{
+    std::string name;
+    std::string text;
+    bool compiles = true;   // False for scanner-only inputs that are not valid expressions.
+};
+
+// Every *.lox file of the corpus directory, sorted by name.
+std::vector<Workload> loadCorpus(const std::string& directory);
+
+// Deterministic generated inputs of about size bytes.
+Workload generateExpression(std::size_t size);
+Workload generateTokenSoup(std::size_t size);